@@ -0,0 +1,603 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <math.h>
+
+/* gptokeyb2-bench, runs controller events through the real engine with the
+ * uinput output captured into memory, and reports how long it took.
+ *
+ * The events come from a file recorded with `gptokeyb2 -R` or are made up
+ * on the spot: a stick going round in circles plus buttons being tapped,
+ * at the given rates. The main loop is run on the virtual clock, so
+ * everything due between two events happens at the right time, without
+ * waiting for it.
+ *
+ * With -d it checks the table and fixed point deadzone maths, and the
+ * response curves, against the float version instead, over every stick
+ * position.
+ */
+
+#define BENCH_RING_SIZE 4096
+#define BENCH_TAIL_MS 1000
+
+typedef struct
+{
+    Uint64 frames;
+    Uint64 events;
+    Uint64 bytes;
+    Uint64 hash;
+    size_t ring_head;
+    struct input_event ring[BENCH_RING_SIZE];
+} bench_output;
+
+static bench_output output;
+
+
+static ssize_t bench_write(int fd, const struct input_event *events, size_t count)
+{   // keep the output, the hash lets two runs be compared.
+    output.frames++;
+    output.events += count;
+    output.bytes += sizeof(struct input_event) * count;
+
+    for (size_t i=0; i < count; i++)
+    {
+        const struct input_event *ev = &events[i];
+        Uint32 values[4] = {(Uint32)fd, ev->type, ev->code, (Uint32)ev->value};
+        const Uint8 *bytes = (const Uint8 *)values;
+
+        for (size_t j=0; j < sizeof(values); j++)
+        {
+            output.hash ^= bytes[j];
+            output.hash *= 0x100000001b3ULL;
+        }
+
+        output.ring[output.ring_head] = *ev;
+        output.ring_head = (output.ring_head + 1) % BENCH_RING_SIZE;
+    }
+
+    return (ssize_t)(sizeof(struct input_event) * count);
+}
+
+static const output_sink bench_sink = {
+    .name = "bench",
+    .write = bench_write,
+};
+
+
+static record_entry *bench_synthesize(Uint32 duration_ms, int axis_rate, int button_rate, size_t *count)
+{   // a stick going round and round, and buttons tapped one after another.
+    static const Uint8 buttons[] = {
+        SDL_CONTROLLER_BUTTON_A,
+        SDL_CONTROLLER_BUTTON_B,
+        SDL_CONTROLLER_BUTTON_X,
+        SDL_CONTROLLER_BUTTON_Y,
+        SDL_CONTROLLER_BUTTON_DPAD_UP,
+        SDL_CONTROLLER_BUTTON_DPAD_DOWN,
+        SDL_CONTROLLER_BUTTON_DPAD_LEFT,
+        SDL_CONTROLLER_BUTTON_DPAD_RIGHT,
+        SDL_CONTROLLER_BUTTON_LEFTSHOULDER,
+        SDL_CONTROLLER_BUTTON_RIGHTSHOULDER,
+    };
+    const int button_count = sizeof(buttons) / sizeof(buttons[0]);
+
+    size_t entries_max = ((size_t)duration_ms * (axis_rate + button_rate)) / 1000 + 2;
+    record_entry *entries = (record_entry *)gptk_malloc(sizeof(record_entry) * entries_max);
+    int axis_accum = 0;
+    int button_accum = 0;
+    Uint64 axis_step = 0;
+    Uint64 button_step = 0;
+
+    *count = 0;
+
+    for (Uint32 ticks=0; ticks < duration_ms; ticks++)
+    {
+        axis_accum += axis_rate;
+        button_accum += button_rate;
+
+        while (axis_accum >= 1000 && *count < entries_max)
+        {
+            record_entry *entry = &entries[(*count)++];
+            double angle = (double)(axis_step / 2) * (M_PI / 90.0);
+            double value = ((axis_step & 1) == 0 ? cos(angle) : sin(angle));
+
+            entry->ticks = ticks;
+            entry->type = RECORD_AXIS;
+            entry->index = ((axis_step & 1) == 0 ? SDL_CONTROLLER_AXIS_LEFTX : SDL_CONTROLLER_AXIS_LEFTY);
+            entry->value = (Sint16)(value * 32767.0);
+
+            axis_step++;
+            axis_accum -= 1000;
+        }
+
+        while (button_accum >= 1000 && *count < entries_max)
+        {
+            record_entry *entry = &entries[(*count)++];
+
+            entry->ticks = ticks;
+            entry->type = ((button_step & 1) == 0 ? RECORD_BUTTON_DOWN : RECORD_BUTTON_UP);
+            entry->index = buttons[(button_step / 2) % button_count];
+
+            button_step++;
+            button_accum -= 1000;
+        }
+    }
+
+    return entries;
+}
+
+
+static void bench_run_until(Uint64 until)
+{   // do what the main loop would while waiting for an event at until.
+    while (true)
+    {
+        Sint64 timeout = event_loop_step(clock_now());
+
+        if (timeout < 0)
+            break;
+
+        // like event_wait, a wait always takes at least a ms.
+        Uint64 due = clock_now() + MS_TO_NS(clock_timeout_ms(timeout > 0 ? timeout : 1));
+
+        if (due > until)
+            break;
+
+        clock_advance_to(due);
+    }
+
+    clock_advance_to(until);
+}
+
+
+static void bench_replay(const record_entry *entries, size_t count)
+{   // the virtual clock follows the event times, so every run gives the same output.
+    SDL_Event event;
+
+    clock_set_virtual(MS_TO_NS(entries[0].ticks));
+    state_reset();
+    event_loop_init(clock_now());
+
+    for (size_t i=0; i < count; i++)
+    {
+        bench_run_until(MS_TO_NS(entries[i].ticks));
+
+        record_to_event(&entries[i], &event);
+        handleInputEvent(&event);
+    }
+
+    // let whatever was still going finish.
+    bench_run_until(MS_TO_NS(entries[count - 1].ticks + BENCH_TAIL_MS));
+
+    state_reset();
+    emit_flush_all();
+}
+
+
+typedef void (*bench_deadzone_func)(int *x, int *y, int in_x, int in_y);
+
+static deadzone_q16 bench_exp_deadzone;
+static float bench_exp_n;
+
+
+static void bench_exp_float(int *x, int *y, int in_x, int in_y)
+{
+    vector2d vec2d_input;
+    vector2d vec2d_ouput;
+
+    vector2d_set_float2(&vec2d_input, (float)(in_x) / 32768.0f, (float)(in_y) / 32768.0f);
+    vector2d_clear(&vec2d_ouput);
+
+    dz_exp(&vec2d_ouput, &vec2d_input, (float)(current_state.deadzone_x) / 32768.0f, bench_exp_n);
+
+    *x = (int)(vec2d_ouput.x * (float)current_state.deadzone_scale * (float)DEADZONE_ONE);
+    *y = (int)(vec2d_ouput.y * (float)current_state.deadzone_scale * (float)DEADZONE_ONE);
+}
+
+
+static void bench_exp_fixed(int *x, int *y, int in_x, int in_y)
+{
+    vector2q vec2q_input = {in_x * 2, in_y * 2};
+    vector2q vec2q_ouput = {0, 0};
+
+    dzq_exp(&vec2q_ouput, &vec2q_input, &bench_exp_deadzone, (Sint32)(bench_exp_n * 65536.0f));
+
+    *x = (int)(((Sint64)vec2q_ouput.x * current_state.deadzone_scale * DEADZONE_ONE) / 65536);
+    *y = (int)(((Sint64)vec2q_ouput.y * current_state.deadzone_scale * DEADZONE_ONE) / 65536);
+}
+
+
+static void bench_curve_float(int *x, int *y, int in_x, int in_y)
+{
+    deadzone_analog_calc_float(ANALOG_LEFT, x, y, in_x, in_y);
+}
+
+
+static void bench_curve_calc(int *x, int *y, int in_x, int in_y)
+{
+    deadzone_analog_calc(ANALOG_LEFT, x, y, in_x, in_y);
+}
+
+
+typedef struct
+{
+    Uint64 points;
+    Uint64 off_by_one;
+    Uint64 over;
+    int worst;
+    int worst_x;
+    int worst_y;
+} bench_deadzone_result;
+
+
+static void bench_deadzone_point(bench_deadzone_result *result, bench_deadzone_func reference, bench_deadzone_func func, int in_x, int in_y)
+{
+    int ref_x, ref_y;
+    int out_x, out_y;
+
+    reference(&ref_x, &ref_y, in_x, in_y);
+    func(&out_x, &out_y, in_x, in_y);
+
+    // in 1/DEADZONE_ONE units, mouse_tick carries the part units so they count.
+    Sint64 diff_x = llabs((Sint64)ref_x - out_x);
+    Sint64 diff_y = llabs((Sint64)ref_y - out_y);
+    Sint64 diff_max = (diff_x > diff_y ? diff_x : diff_y);
+    int diff = (diff_max > INT32_MAX ? INT32_MAX : (int)diff_max);
+
+    result->points++;
+
+    if (diff > DEADZONE_ONE)
+        result->over++;
+
+    else if (diff > 0)
+        result->off_by_one++;
+
+    if (diff > result->worst)
+    {
+        result->worst = diff;
+        result->worst_x = in_x;
+        result->worst_y = in_y;
+    }
+}
+
+
+static bool bench_deadzone_compare(const char *name, bench_deadzone_func reference, bench_deadzone_func func, int step)
+{   /* true if func is never more than one unit away from reference.
+     * The edges and either side of the deadzone are always checked, so a
+     * big step still catches the places things usually go wrong.
+     */
+    bench_deadzone_result result;
+    int deadzone = current_state.deadzone_x;
+    int diagonal = (int)((float)deadzone * 0.70710678f);
+    int edges[] = {
+        -32768, -32767, 0, 32767,
+        -deadzone - 1, -deadzone, -deadzone + 1,
+        deadzone - 1, deadzone, deadzone + 1,
+        -diagonal - 1, -diagonal, -diagonal + 1,
+        diagonal - 1, diagonal, diagonal + 1,
+        };
+    int edge_count = sizeof(edges) / sizeof(edges[0]);
+
+    memset(&result, 0, sizeof(result));
+
+    for (int in_y=-32768; in_y < 32768; in_y += step)
+    {
+        for (int in_x=-32768; in_x < 32768; in_x += step)
+            bench_deadzone_point(&result, reference, func, in_x, in_y);
+    }
+
+    for (int i=0; i < edge_count; i++)
+    {
+        if (edges[i] < -32768 || edges[i] > 32767)
+            continue;
+
+        for (int j=0; j < edge_count; j++)
+        {
+            if (edges[j] < -32768 || edges[j] > 32767)
+                continue;
+
+            bench_deadzone_point(&result, reference, func, edges[j], edges[i]);
+        }
+    }
+
+    printf("%-14s worst %.3f", name, (double)result.worst / DEADZONE_ONE);
+
+    if (result.worst > 0)
+        printf(" at %d, %d", result.worst_x, result.worst_y);
+
+    printf(", %" PRIu64 " off by up to one, %" PRIu64 " more, of %" PRIu64 "\n", result.off_by_one, result.over, result.points);
+
+    return (result.over == 0);
+}
+
+
+static int bench_deadzone_check(int step)
+{   // compare the deadzone maths to the float version, using the loaded [config].
+    static const float exponents[] = {0.5f, 1.5f, 2.0f, 3.0f};
+    static const char *curves[] = {"exp\t0.5", "exp\t2", "exp\t3", "s_curve", "points\t0.3,0.1\t0.7,0.6"};
+    analog_curve left_analog_curve = current_state.left_analog_curve;
+    bool passed = true;
+    char name[32];
+
+    printf("deadzone:     %s, deadzone %d, scale %d, every %d\n",
+        deadzone_mode_str(current_state.deadzone_mode), current_state.deadzone_x,
+        current_state.deadzone_scale, step);
+
+    current_state.deadzone_math = DZM_TABLE;
+    deadzone_update();
+    passed &= bench_deadzone_compare("table", deadzone_mouse_calc_float, deadzone_mouse_calc, step);
+
+    current_state.deadzone_math = DZM_FIXED;
+    deadzone_update();
+    passed &= bench_deadzone_compare("fixed", deadzone_mouse_calc_float, deadzone_mouse_calc, step);
+
+    deadzone_q16_set(&bench_exp_deadzone, current_state.deadzone_x);
+
+    for (size_t i=0; i < sizeof(exponents) / sizeof(exponents[0]); i++)
+    {
+        bench_exp_n = exponents[i];
+        snprintf(name, sizeof(name), "fixed exp %.1f", exponents[i]);
+        passed &= bench_deadzone_compare(name, bench_exp_float, bench_exp_fixed, step);
+    }
+
+    // the left stick's curve from the config, then some others in its place.
+    current_state.deadzone_math = DZM_TABLE;
+
+    for (size_t i=0; i <= sizeof(curves) / sizeof(curves[0]); i++)
+    {
+        if (i > 0)
+        {
+            token_ctx *token_state = tokens_create(curves[i - 1], '\t');
+
+            analog_curve_parse(&current_state.left_analog_curve, tokens_next(token_state), token_state);
+            tokens_free(token_state);
+        }
+
+        if (current_state.left_analog_curve.type == CURVE_LINEAR)
+            continue;
+
+        deadzone_update();
+
+        snprintf(name, sizeof(name), "curve %d", (int)i);
+        analog_curve_dump(name, &current_state.left_analog_curve);
+        passed &= bench_deadzone_compare(name, bench_curve_float, bench_curve_calc, step);
+    }
+
+    current_state.left_analog_curve = left_analog_curve;
+    deadzone_update();
+
+    return (passed ? 0 : 1);
+}
+
+
+static void bench_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-x] [-c config.ini] [-p control] [-r events.rec | -t ms -a rate -b rate] [-n runs] [-v]\n", program);
+    fprintf(stderr, "       %s [-c config.ini] -d step\n", program);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -c  \"config.ini\"    - config file to load.\n");
+    fprintf(stderr, "  -p  \"control\"       - what control mode to start in.\n");
+    fprintf(stderr, "  -x                  - xbox360 mode.\n");
+    fprintf(stderr, "  -r  \"events.rec\"    - replay a recording made with gptokeyb2 -R.\n");
+    fprintf(stderr, "  -t  ms              - length of the made up events, default 10000.\n");
+    fprintf(stderr, "  -a  rate            - axis events per second, default 1000.\n");
+    fprintf(stderr, "  -b  rate            - button events per second, default 20.\n");
+    fprintf(stderr, "  -n  runs            - how many times to replay, default 10.\n");
+    fprintf(stderr, "  -v                  - keep the engine's own output.\n");
+    fprintf(stderr, "  -d  step            - check the deadzone maths against the float version every step units, 1 checks them all.\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    char record_file[MAX_PATH] = "";
+    Uint32 duration_ms = 10000;
+    int axis_rate = 1000;
+    int button_rate = 20;
+    int runs = 10;
+    int check_step = 0;
+    bool verbose = false;
+    int opt;
+
+    string_init();
+    keys_init();
+    state_init();
+    config_init();
+    input_init();
+
+    user_config_file[0] = '\0';
+    config_mode = true;
+
+    while ((opt = getopt(argc, argv, "c:p:xr:t:a:b:n:vd:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config_add_file(optarg);
+            config_mode = true;
+            xbox360_mode = false;
+            break;
+
+        case 'p':
+            strncpy(default_control, optarg, MAX_CONTROL_NAME - 1);
+            break;
+
+        case 'x':
+            config_mode = false;
+            xbox360_mode = true;
+            break;
+
+        case 'r':
+            strncpy(record_file, optarg, MAX_PATH - 1);
+            break;
+
+        case 't':
+            duration_ms = (Uint32)atoi(optarg);
+            break;
+
+        case 'a':
+            axis_rate = atoi(optarg);
+            break;
+
+        case 'b':
+            button_rate = atoi(optarg);
+            break;
+
+        case 'n':
+            runs = atoi(optarg);
+            break;
+
+        case 'v':
+            verbose = true;
+            break;
+
+        case 'd':
+            check_step = atoi(optarg);
+
+            if (check_step < 1)
+            {
+                bench_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        default:
+            bench_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (axis_rate < 0 || button_rate < 0 || runs < 1)
+    {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    if (config_load_all(false, false))
+        return 1;
+
+    if (check_step > 0)
+        return bench_deadzone_check(check_step);
+
+    if (config_mode)
+        config_select_default(default_control);
+
+    state_change_update();
+
+    record_entry *entries;
+    size_t count;
+
+    if (strlen(record_file) > 0)
+    {
+        entries = record_load(record_file, &count);
+
+        if (entries == NULL)
+            return 1;
+    }
+    else
+    {
+        entries = bench_synthesize(duration_ms, axis_rate, button_rate, &count);
+    }
+
+    if (count == 0)
+    {
+        fprintf(stderr, "bench: no events to replay\n");
+        return 1;
+    }
+
+    // nothing leaves the process, the frames end up in bench_write.
+    output_set_sink(&bench_sink);
+
+    setupFakeKeyboardMouseDevice();
+    setupFakeAbsoluteMouseDevice();
+
+    if (xbox360_mode)
+        setupFakeXbox360Device();
+
+    int stdout_fd = -1;
+
+    if (!verbose)
+    {   // the engine's debug output would swamp the results.
+        fflush(stdout);
+        stdout_fd = dup(STDOUT_FILENO);
+
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+    }
+
+    Uint64 best_ns = 0;
+    Uint64 total_ns = 0;
+    Uint64 first_hash = 0;
+    bool hash_stable = true;
+
+    for (int run=0; run < runs; run++)
+    {
+        memset(&output, 0, sizeof(output));
+        output.hash = 0xcbf29ce484222325ULL;
+
+        Uint64 start_ns = clock_monotonic_ns();
+
+        bench_replay(entries, count);
+
+        Uint64 elapsed_ns = clock_monotonic_ns() - start_ns;
+
+        total_ns += elapsed_ns;
+
+        if (run == 0 || elapsed_ns < best_ns)
+            best_ns = elapsed_ns;
+
+        if (run == 0)
+            first_hash = output.hash;
+        else if (output.hash != first_hash)
+            hash_stable = false;
+    }
+
+    if (stdout_fd >= 0)
+    {
+        fflush(stdout);
+        dup2(stdout_fd, STDOUT_FILENO);
+        close(stdout_fd);
+    }
+
+    output_set_sink(NULL);
+    clock_set_real();
+
+    printf("events:       %zu (%u ms of input)\n", count, (unsigned)(entries[count - 1].ticks - entries[0].ticks));
+    printf("runs:         %d\n", runs);
+    printf("best:         %.3f ms, %.0f events/s, %.1f ns/event\n",
+        best_ns / 1000000.0, count * 1000000000.0 / best_ns, (double)best_ns / count);
+    printf("mean:         %.3f ms, %.1f ns/event\n",
+        total_ns / 1000000.0 / runs, (double)total_ns / runs / count);
+    printf("output:       %" PRIu64 " frames, %" PRIu64 " events, %" PRIu64 " bytes\n",
+        output.frames, output.events, output.bytes);
+    printf("output hash:  %016" PRIx64 "%s\n", first_hash, (hash_stable ? "" : " (differs between runs)"));
+
+    free(entries);
+
+    config_quit();
+    state_quit();
+    input_quit();
+    string_quit();
+
+    return 0;
+}
@@ -36,6 +36,7 @@
 */
 
 #include "gptokeyb2.h"
+#include <math.h>
 
 /* Code based on:
  * https://github.com/Minimuino/thumbstick-deadzones
@@ -192,6 +193,276 @@ void dz_exp(vector2d *vec2d_ouput, const vector2d *vec2d_input, float deadzone,
 }
 
 
+/* Fixed point versions of the above, in Q16 so 1.0 is 65536, for the
+ * handhelds without an FPU. Moving the mouse only uses integer maths, any
+ * float maths is done once when the settings are loaded, like the sqrt in
+ * deadzone_q16_set. The steps that need it work with 24 fractional bits,
+ * or 30 for the response curves near the deadzone.
+ * They give the same results as the float versions to within one unit of
+ * deadzone_scale, see gptokeyb2-bench -d.
+ */
+
+#define Q16_ONE 65536
+
+// 2^(2^-n) for n = 1..24, with 30 fractional bits.
+static const Uint64 dz_exp2_bits[24] = {
+    1518500250ULL, 1276901417ULL, 1170923762ULL, 1121280436ULL,
+    1097253708ULL, 1085434106ULL, 1079572136ULL, 1076653033ULL,
+    1075196443ULL, 1074468888ULL, 1074105294ULL, 1073923544ULL,
+    1073832680ULL, 1073787251ULL, 1073764537ULL, 1073753181ULL,
+    1073747502ULL, 1073744663ULL, 1073743244ULL, 1073742534ULL,
+    1073742179ULL, 1073742001ULL, 1073741913ULL, 1073741868ULL,
+};
+
+
+static Sint64 dz_isqrt(Sint64 value)
+{   // integer square root, bit by bit.
+    Uint64 op = (Uint64)value;
+    Uint64 result = 0;
+    Uint64 one = 1ULL << 62;
+
+    while (one > op)
+        one >>= 2;
+
+    while (one != 0)
+    {
+        if (op >= result + one)
+        {
+            op -= result + one;
+            result = (result >> 1) + one;
+        }
+        else
+        {
+            result >>= 1;
+        }
+
+        one >>= 2;
+    }
+
+    return (Sint64)result;
+}
+
+
+static Sint32 q16_abs(Sint32 value)
+{
+    return (value < 0 ? -value : value);
+}
+
+
+static Sint64 dz_log2(Uint64 value, int frac_bits)
+{   /* log2 of value, which has frac_bits fractional bits and must be above
+     * 0. The result has 24 fractional bits.
+     */
+    Sint64 result = -((Sint64)frac_bits << 24);
+
+    // get it into 1.0 .. 2.0 with 30 fractional bits.
+    while (value >= (2ULL << 30))
+    {
+        value >>= 1;
+        result += (1 << 24);
+    }
+
+    while (value < (1ULL << 30))
+    {
+        value <<= 1;
+        result -= (1 << 24);
+    }
+
+    result += ((Sint64)30 << 24);
+
+    for (Sint64 bit = (1 << 23); bit > 0; bit >>= 1)
+    {
+        value = (value * value) >> 30;
+
+        if (value >= (2ULL << 30))
+        {
+            value >>= 1;
+            result += bit;
+        }
+    }
+
+    return result;
+}
+
+
+static Sint64 dz_exp2(Sint64 value, int frac_bits)
+{   // 2^value, value has 24 fractional bits, the result has frac_bits.
+    Sint64 whole = (value >> 24) + frac_bits - 30;
+    Uint32 frac = (Uint32)(value & 0xFFFFFF);
+    Uint64 result = 1ULL << 30;
+
+    for (int i=0; i < 24; i++)
+    {
+        if (frac & (0x800000 >> i))
+            result = (result * dz_exp2_bits[i]) >> 30;
+    }
+
+    if (whole >= 0)
+        return (whole > 32 ? INT64_MAX : (Sint64)(result << whole));
+
+    return (whole < -62 ? 0 : (Sint64)(result >> -whole));
+}
+
+
+Sint32 q16_pow(Sint32 value, Sint32 n)
+{   // value^n, value must be above 0 and n is Q16 as well.
+    Sint64 result = dz_exp2((dz_log2((Uint64)value, 16) * n) >> 16, 16);
+
+    return (Sint32)(result > INT32_MAX ? INT32_MAX : result);
+}
+
+
+void deadzone_q16_set(deadzone_q16 *dz, int deadzone)
+{   /* deadzone is in stick units. The radial modes compare the float
+     * magnitude to it, so find the smallest x^2 + y^2 that lets through to
+     * cut off at exactly the same place.
+     */
+    Sint64 radial = (Sint64)deadzone * deadzone;
+    float limit = (float)deadzone;
+
+    while (radial > 0 && (float)sqrt((double)(radial - 1)) >= limit)
+        radial--;
+
+    dz->value  = deadzone * 2;
+    dz->radial = radial * 4;
+}
+
+
+void dzq_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    if (q16_abs(vec2q_input->x) > dz->value)
+        vec2q_output->x = vec2q_input->x;
+
+    if (q16_abs(vec2q_input->y) > dz->value)
+        vec2q_output->y = vec2q_input->y;
+}
+
+
+void dzq_radial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    Sint64 magnitude_sq = (Sint64)vec2q_input->x * vec2q_input->x + (Sint64)vec2q_input->y * vec2q_input->y;
+
+    if (magnitude_sq >= dz->radial)
+        *vec2q_output = *vec2q_input;
+}
+
+
+static Sint64 dz_mul_div(Sint64 value, Sint64 mul, Sint64 divisor)
+{   // value * mul / divisor, without value * mul overflowing when value is large.
+    return (value / divisor) * mul + ((value % divisor) * mul) / divisor;
+}
+
+
+static bool dzq_scaled_radial_frac(Sint64 *x, Sint64 *y, Sint64 *range, const vector2q *vec2q_input, const deadzone_q16 *dz, int frac_bits)
+{   /* dzq_scaled_radial with frac_bits fractional bits, up to 30, what comes
+     * after it in hybrid, exp and the curves needs more precision than Q16
+     * near the deadzone and the corners. Returns false if it is inside the
+     * deadzone.
+     */
+    Sint64 magnitude_sq = (Sint64)vec2q_input->x * vec2q_input->x + (Sint64)vec2q_input->y * vec2q_input->y;
+
+    if (magnitude_sq < dz->radial || magnitude_sq == 0 || dz->value >= Q16_ONE)
+        return false;
+
+    // magnitude and range with 30 fractional bits.
+    Sint64 magnitude = dz_isqrt(magnitude_sq << 28);
+    Sint64 range_30 = ((magnitude - ((Sint64)dz->value << 14)) << 16) / (Q16_ONE - dz->value);
+
+    *range = range_30 >> (30 - frac_bits);
+    *x = dz_mul_div(range_30, (Sint64)vec2q_input->x << (frac_bits - 16), magnitude);
+    *y = dz_mul_div(range_30, (Sint64)vec2q_input->y << (frac_bits - 16), magnitude);
+
+    return true;
+}
+
+
+void dzq_scaled_radial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    Sint64 x, y, range;
+
+    if (!dzq_scaled_radial_frac(&x, &y, &range, vec2q_input, dz, 24))
+        return;
+
+    vec2q_output->x = (Sint32)(x / 256);
+    vec2q_output->y = (Sint32)(y / 256);
+}
+
+
+void dzq_sloped_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    Sint32 deadzone_x = (Sint32)(((Sint64)dz->value * q16_abs(vec2q_input->x) + 0x8000) >> 16);
+    Sint32 deadzone_y = (Sint32)(((Sint64)dz->value * q16_abs(vec2q_input->y) + 0x8000) >> 16);
+
+    *vec2q_output = *vec2q_input;
+
+    if (q16_abs(vec2q_output->x) < deadzone_x)
+        vec2q_output->x = 0;
+
+    if (q16_abs(vec2q_output->y) < deadzone_y)
+        vec2q_output->y = 0;
+}
+
+
+static Sint64 dzq_sloped_scaled_frac(Sint64 value, const deadzone_q16 *dz, int frac_bits)
+{   // one axis of dzq_sloped_scaled_axial, value and the result have frac_bits fractional bits.
+    Sint64 one = (Sint64)1 << frac_bits;
+    Sint64 magnitude = (value < 0 ? -value : value);
+    Sint64 deadzone = ((Sint64)dz->value * magnitude + 0x8000) >> 16;
+
+    if (magnitude <= deadzone || deadzone == one)
+        return 0;
+
+    // map_range(magnitude, deadzone, 1.0, 0.0, 1.0)
+    Sint64 result = dz_mul_div(magnitude - deadzone, one, one - deadzone);
+
+    return (value < 0 ? -result : result);
+}
+
+
+void dzq_sloped_scaled_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    Sint32 x = (Sint32)(dzq_sloped_scaled_frac((Sint64)vec2q_input->x << 8, dz, 24) / 256);
+    Sint32 y = (Sint32)(dzq_sloped_scaled_frac((Sint64)vec2q_input->y << 8, dz, 24) / 256);
+
+    if (x != 0)
+        vec2q_output->x = x;
+
+    if (y != 0)
+        vec2q_output->y = y;
+}
+
+
+void dzq_hybrid(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz)
+{
+    Sint64 x, y, range;
+
+    if (!dzq_scaled_radial_frac(&x, &y, &range, vec2q_input, dz, 24))
+        return;
+
+    vec2q_output->x = (Sint32)(dzq_sloped_scaled_frac(x, dz, 24) / 256);
+    vec2q_output->y = (Sint32)(dzq_sloped_scaled_frac(y, dz, 24) / 256);
+}
+
+
+void dzq_exp(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz, Sint32 n)
+{   // n is Q16 as well.
+    Sint64 x, y, range;
+
+    if (!dzq_scaled_radial_frac(&x, &y, &range, vec2q_input, dz, 24))
+        return;
+
+    // fabs(input_magnitude) < 0.0001
+    if (range * 10000 < (1 << 24))
+        return;
+
+    // the partial output's magnitude is range, scale it to range^n.
+    Sint64 scale = dz_exp2((dz_log2((Uint64)range, 24) * n) >> 16, 24);
+
+    vec2q_output->x = (Sint32)(((x * scale) / range) / 256);
+    vec2q_output->y = (Sint32)(((y * scale) / range) / 256);
+}
+
+
 int deadzone_get_mode(const char *str)
 {
     if (strcasecmp(str, "axial") == 0)
@@ -219,6 +490,39 @@ int deadzone_get_mode(const char *str)
     return DZ_DEFAULT;
 }
 
+int deadzone_get_math(const char *str)
+{
+    if (strcasecmp(str, "table") == 0)
+        return DZM_TABLE;
+
+    else if (strcasecmp(str, "fixed") == 0)
+        return DZM_FIXED;
+
+    else if (strcasecmp(str, "float") == 0)
+        return DZM_FLOAT;
+
+    // default
+    return DZM_TABLE;
+}
+
+
+const char *deadzone_math_str(int math)
+{
+    switch(math)
+    {
+    default:
+    case DZM_TABLE:
+        return "table";
+
+    case DZM_FIXED:
+        return "fixed";
+
+    case DZM_FLOAT:
+        return "float";
+    }
+}
+
+
 const char *deadzone_mode_str(int mode)
 {
 
@@ -259,13 +563,105 @@ void deadzone_trigger_calc(int *analog, int analog_in)
 }
 
 
-void deadzone_mouse_calc(int *x, int *y, int in_x, int in_y)
+static deadzone_q16 dz_q16;
+
+
+void deadzone_mouse_calc_fixed(int *x, int *y, int in_x, int in_y)
 {
+    vector2q vec2q_input = {in_x * 2, in_y * 2};
+    vector2q vec2q_ouput = {0, 0};
+
+    switch(current_state.deadzone_mode)
+    {
+    default:
+    case DZ_DEFAULT:
+    case DZ_AXIAL:
+        dzq_axial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_RADIAL:
+        dzq_radial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_SCALED_RADIAL:
+        dzq_scaled_radial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_SLOPED_AXIAL:
+        dzq_sloped_axial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_SLOPED_SCALED_AXIAL:
+        dzq_sloped_scaled_axial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_HYBRID:
+        dzq_hybrid(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+    }
+
+    *x = (int)(((Sint64)vec2q_ouput.x * current_state.deadzone_scale * DEADZONE_ONE) / Q16_ONE);
+    *y = (int)(((Sint64)vec2q_ouput.y * current_state.deadzone_scale * DEADZONE_ONE) / Q16_ONE);
+}
+
+
+static void deadzone_calc_fixed_frac(Sint64 *x, Sint64 *y, int in_x, int in_y, int frac_bits)
+{   /* the deadzone with frac_bits fractional bits, up to 30, before
+     * deadzone_scale. The response curves multiply any mistakes near the
+     * deadzone.
+     */
+    vector2q vec2q_input = {in_x * 2, in_y * 2};
+    vector2q vec2q_ouput = {0, 0};
+    Sint64 range;
+
+    *x = *y = 0;
+
+    switch(current_state.deadzone_mode)
+    {
+    default:
+    case DZ_DEFAULT:
+    case DZ_AXIAL:
+        dzq_axial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_RADIAL:
+        dzq_radial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_SCALED_RADIAL:
+        dzq_scaled_radial_frac(x, y, &range, &vec2q_input, &dz_q16, frac_bits);
+        return;
+
+    case DZ_SLOPED_AXIAL:
+        dzq_sloped_axial(&vec2q_ouput, &vec2q_input, &dz_q16);
+        break;
+
+    case DZ_SLOPED_SCALED_AXIAL:
+        *x = dzq_sloped_scaled_frac((Sint64)vec2q_input.x << (frac_bits - 16), &dz_q16, frac_bits);
+        *y = dzq_sloped_scaled_frac((Sint64)vec2q_input.y << (frac_bits - 16), &dz_q16, frac_bits);
+        return;
+
+    case DZ_HYBRID:
+        if (dzq_scaled_radial_frac(x, y, &range, &vec2q_input, &dz_q16, frac_bits))
+        {
+            *x = dzq_sloped_scaled_frac(*x, &dz_q16, frac_bits);
+            *y = dzq_sloped_scaled_frac(*y, &dz_q16, frac_bits);
+        }
+        return;
+    }
+
+    // the rest don't change the input, so these are exact.
+    *x = (Sint64)vec2q_ouput.x << (frac_bits - 16);
+    *y = (Sint64)vec2q_ouput.y << (frac_bits - 16);
+}
+
+
+static void deadzone_calc_float(vector2d *vec2d_ouput, int in_x, int in_y)
+{   // the deadzone as a float, before deadzone_scale.
     vector2d vec2d_input;
-    vector2d vec2d_ouput;
 
     vector2d_set_float2(&vec2d_input, (float)(in_x) / 32768.0f, (float)(in_y) / 32768.0f);
-    vector2d_clear(&vec2d_ouput);
+    vector2d_clear(vec2d_ouput);
 
     float dz = (float)(current_state.deadzone_x) / 32768.0f;
 
@@ -274,31 +670,637 @@ void deadzone_mouse_calc(int *x, int *y, int in_x, int in_y)
     default:
     case DZ_DEFAULT:
     case DZ_AXIAL:
-        dz_axial(&vec2d_ouput, &vec2d_input, dz);
+        dz_axial(vec2d_ouput, &vec2d_input, dz);
         break;
 
     case DZ_RADIAL:
-        dz_radial(&vec2d_ouput, &vec2d_input, dz);
+        dz_radial(vec2d_ouput, &vec2d_input, dz);
         break;
 
     case DZ_SCALED_RADIAL:
-        dz_scaled_radial(&vec2d_ouput, &vec2d_input, dz);
+        dz_scaled_radial(vec2d_ouput, &vec2d_input, dz);
         break;
 
     case DZ_SLOPED_AXIAL:
-        dz_sloped_axial(&vec2d_ouput, &vec2d_input, dz);
+        dz_sloped_axial(vec2d_ouput, &vec2d_input, dz);
         break;
 
     case DZ_SLOPED_SCALED_AXIAL:
-        dz_sloped_scaled_axial(&vec2d_ouput, &vec2d_input, dz);
+        dz_sloped_scaled_axial(vec2d_ouput, &vec2d_input, dz);
         break;
 
     case DZ_HYBRID:
-        dz_hybrid(&vec2d_ouput, &vec2d_input, dz);
+        dz_hybrid(vec2d_ouput, &vec2d_input, dz);
+        break;
+    }
+}
+
+
+void deadzone_mouse_calc_float(int *x, int *y, int in_x, int in_y)
+{   // the reference version, see deadzone_update for the tables.
+    vector2d vec2d_ouput;
+
+    deadzone_calc_float(&vec2d_ouput, in_x, in_y);
+
+    *x = (int)(vec2d_ouput.x * (float)current_state.deadzone_scale * (float)DEADZONE_ONE);
+    *y = (int)(vec2d_ouput.y * (float)current_state.deadzone_scale * (float)DEADZONE_ONE);
+}
+
+
+/* Deadzone lookup tables.
+ *
+ * The float version above does a sqrt, pow and a few divides per call, which
+ * is slow on the handhelds without a decent FPU. Every mode is a mix of:
+ *
+ * - a cut off on the magnitude: radial, scaled_radial and hybrid.
+ * - scaling by a factor of the magnitude: scaled_radial and hybrid.
+ * - a curve on each axis: every mode, with deadzone_scale folded in.
+ *
+ * so deadzone_update bakes the factor and the curve into tables for the
+ * current deadzone settings, and deadzone_mouse_calc does a lookup and a
+ * linear interpolation for each.
+ *
+ * The tables are indexed by stick values with 4 fractional bits and cover
+ * 0..65536 so the corners, and the hybrid mode's scaled values, fit. The
+ * results are spot checked against the float version when they are built
+ * and must be within one unit of it, otherwise the float version is used.
+ */
+
+#define DZ_LUT_BITS 12
+#define DZ_LUT_SIZE ((1 << DZ_LUT_BITS) + 1)
+#define DZ_LUT_FRAC 4
+#define DZ_LUT_INPUT_MAX (65536 << DZ_LUT_FRAC)
+#define DZ_LUT_STEP_BITS (16 + DZ_LUT_FRAC - DZ_LUT_BITS)
+#define DZ_LUT_CLAMP ((double)(1 << 30))
+
+typedef struct
+{
+    bool valid;
+
+    // |x| <= this is zero, -1 if there is no cut off.
+    int axis_deadzone;
+
+    // x^2 + y^2 < this is zero, 0 if there is no cut off.
+    Sint64 radial_deadzone;
+
+    // factor of the magnitude, 24 fractional bits.
+    bool radial_scaled;
+    Sint32 radial[DZ_LUT_SIZE];
+
+    // output for |x|, DEADZONE_FRAC_BITS fractional bits.
+    Sint32 axis[DZ_LUT_SIZE];
+} deadzone_lut;
+
+static deadzone_lut dz_lut;
+
+
+static Sint32 dz_lut_fetch(const Sint32 *table, Sint64 value)
+{   // value has DZ_LUT_FRAC fractional bits.
+    if (value >= DZ_LUT_INPUT_MAX)
+        value = DZ_LUT_INPUT_MAX - 1;
+
+    int index = (int)(value >> DZ_LUT_STEP_BITS);
+    Sint32 frac = (Sint32)(value & ((1 << DZ_LUT_STEP_BITS) - 1));
+
+    return table[index] + (Sint32)(((Sint64)(table[index + 1] - table[index]) * frac) >> DZ_LUT_STEP_BITS);
+}
+
+
+static Sint32 dz_lut_value(double value, double scale)
+{   // clamp anything that won't fit, the check will throw the table out if it matters.
+    value *= scale;
+
+    if (!isfinite(value) || value > DZ_LUT_CLAMP)
+        return (Sint32)DZ_LUT_CLAMP;
+
+    if (value < -DZ_LUT_CLAMP)
+        return -(Sint32)DZ_LUT_CLAMP;
+
+    return (Sint32)lround(value);
+}
+
+
+static void dz_lut_calc(int *x, int *y, int in_x, int in_y)
+{
+    Sint64 value_x = in_x;
+    Sint64 value_y = in_y;
+
+    if (dz_lut.radial_deadzone > 0 &&
+        value_x * value_x + value_y * value_y < dz_lut.radial_deadzone)
+    {
+        *x = *y = 0;
+        return;
+    }
+
+    if (dz_lut.axis_deadzone >= 0)
+    {
+        if (abs(in_x) <= dz_lut.axis_deadzone)
+            value_x = 0;
+
+        if (abs(in_y) <= dz_lut.axis_deadzone)
+            value_y = 0;
+    }
+
+    value_x <<= DZ_LUT_FRAC;
+    value_y <<= DZ_LUT_FRAC;
+
+    if (dz_lut.radial_scaled)
+    {
+        Sint64 magnitude = dz_isqrt(((Sint64)in_x * in_x + (Sint64)in_y * in_y) << (DZ_LUT_FRAC * 2));
+        Sint32 factor = dz_lut_fetch(dz_lut.radial, magnitude);
+
+        value_x = (value_x * factor) >> 24;
+        value_y = (value_y * factor) >> 24;
+    }
+
+    Sint32 out_x = dz_lut_fetch(dz_lut.axis, llabs(value_x));
+    Sint32 out_y = dz_lut_fetch(dz_lut.axis, llabs(value_y));
+
+    *x = (value_x < 0 ? -out_x : out_x);
+    *y = (value_y < 0 ? -out_y : out_y);
+}
+
+
+static bool dz_lut_check()
+{   /* Compare the tables to the float version at a few points, in the middle,
+     * either side of the deadzone and out to the edge in a few directions.
+     * gptokeyb2-bench -d 1 checks every point.
+     */
+    static const int directions[][2] = {{2, 0}, {0, -2}, {2, 2}, {-2, 1}};
+    int deadzone = current_state.deadzone_x;
+    int magnitudes[] = {0, deadzone - 1, deadzone, deadzone + 1, 8192, 16384, 24576, 32767};
+
+    for (size_t m=0; m < sizeof(magnitudes) / sizeof(magnitudes[0]); m++)
+    {
+        int magnitude = (magnitudes[m] < 0 ? 0 : (magnitudes[m] > 32767 ? 32767 : magnitudes[m]));
+
+        for (size_t d=0; d < sizeof(directions) / sizeof(directions[0]); d++)
+        {
+            int in_x = magnitude * directions[d][0] / 2;
+            int in_y = magnitude * directions[d][1] / 2;
+            int float_x, float_y;
+            int lut_x, lut_y;
+
+            deadzone_mouse_calc_float(&float_x, &float_y, in_x, in_y);
+            dz_lut_calc(&lut_x, &lut_y, in_x, in_y);
+
+            // compared before rounding, the mouse carries the part units.
+            if (abs(float_x - lut_x) > DEADZONE_ONE || abs(float_y - lut_y) > DEADZONE_ONE)
+            {
+                GPTK2_DEBUG("deadzone: table gives %d, %d for %d, %d instead of %d, %d\n",
+                    lut_x, lut_y, in_x, in_y, float_x, float_y);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/* Response curves.
+ *
+ * The deadzone gives a vector with a magnitude of 0..1, a bit more in the
+ * corners, which is then multiplied by deadzone_scale. A curve changes the
+ * magnitude before that, so small movements can be slowed down for aiming
+ * while a full push still moves at full speed:
+ *
+ * - linear: no change, the default.
+ * - exp n: magnitude^n, like dz_exp but after any deadzone mode.
+ * - s_curve: smoothstep, slow at both ends and fast in the middle.
+ * - points x,y ...: straight lines between the points, from 0,0 to 1,1.
+ *
+ * Each stick has its own curve, set with left_analog_curve and
+ * right_analog_curve. deadzone_update bakes them into tables, past 1.0 they
+ * carry on in a straight line. The float version works them out every time.
+ * The points are a table already, so they are used as they are.
+ *
+ * The tables are indexed by the square root of the magnitude, so there are
+ * more entries near the middle of the stick where exp curves with n below 1
+ * are steep. Small mistakes there are multiplied by the curve.
+ */
+
+#define CURVE_LUT_BITS 10
+#define CURVE_LUT_SIZE ((1 << CURVE_LUT_BITS) + 1)
+#define CURVE_LUT_STEP_BITS (24 - CURVE_LUT_BITS)
+
+typedef struct
+{
+    // the curve at sqrt(magnitude) over 0..1, 24 fractional bits.
+    Sint32 value[CURVE_LUT_SIZE];
+} curve_lut;
+
+static curve_lut analog_curve_lut[2];
+
+
+void analog_curve_reset(analog_curve *curve)
+{
+    memset(curve, 0, sizeof(analog_curve));
+
+    curve->type = CURVE_LINEAR;
+    curve->exponent = 2 * Q16_ONE;
+}
+
+
+static int analog_curve_q16(double value, double min, double max)
+{
+    if (!isfinite(value) || value < min)
+        value = min;
+
+    if (value > max)
+        value = max;
+
+    return (int)lround(value * Q16_ONE);
+}
+
+
+void analog_curve_parse(analog_curve *curve, const char *value, token_ctx *token_state)
+{   // linear, exp [n], s_curve or points x,y ...
+    analog_curve_reset(curve);
+
+    while (value != NULL && strlen(value) == 0)
+        value = tokens_next(token_state);
+
+    if (value == NULL || strcasecmp(value, "linear") == 0)
+        return;
+
+    if (strcasecmp(value, "exp") == 0)
+    {
+        curve->type = CURVE_EXP;
+
+        value = tokens_next(token_state);
+
+        if (value != NULL && strlen(value) > 0)
+            curve->exponent = analog_curve_q16(atof(value), 0.1, 10.0);
+
+        return;
+    }
+
+    if (strcasecmp(value, "s_curve") == 0)
+    {
+        curve->type = CURVE_S;
+        return;
+    }
+
+    if (strcasecmp(value, "points") == 0)
+    {
+        int last_x = 0;
+
+        curve->type = CURVE_POINTS;
+
+        while ((value = tokens_next(token_state)) != NULL)
+        {
+            double point_x, point_y;
+
+            if (strlen(value) == 0)
+                continue;
+
+            if (sscanf(value, "%lf,%lf", &point_x, &point_y) != 2)
+            {
+                fprintf(stderr, "analog curve: point \"%s\" should be x,y\n", value);
+                continue;
+            }
+
+            if (curve->points >= CURVE_POINTS_MAX)
+            {
+                fprintf(stderr, "analog curve: only %d points are allowed\n", CURVE_POINTS_MAX);
+                break;
+            }
+
+            int q16_x = analog_curve_q16(point_x, 0.0, 1.0);
+            int q16_y = analog_curve_q16(point_y, 0.0, 1.0);
+
+            if (q16_x <= last_x)
+            {
+                fprintf(stderr, "analog curve: point \"%s\" must come after the one before it\n", value);
+                continue;
+            }
+
+            curve->point_x[curve->points] = q16_x;
+            curve->point_y[curve->points] = q16_y;
+            curve->points++;
+
+            last_x = q16_x;
+        }
+
+        if (curve->points == 0)
+        {
+            fprintf(stderr, "analog curve: points used without any points, using linear\n");
+            analog_curve_reset(curve);
+        }
+
+        return;
+    }
+
+    fprintf(stderr, "analog curve: unknown curve \"%s\", using linear\n", value);
+}
+
+
+void analog_curve_dump(const char *name, const analog_curve *curve)
+{
+    printf("%s = ", name);
+
+    switch(curve->type)
+    {
+    default:
+    case CURVE_LINEAR:
+        printf("linear");
+        break;
+
+    case CURVE_EXP:
+        printf("exp %.4g", (double)curve->exponent / Q16_ONE);
+        break;
+
+    case CURVE_S:
+        printf("s_curve");
+        break;
+
+    case CURVE_POINTS:
+        printf("points");
+
+        for (int i=0; i < curve->points; i++)
+            printf(" %.4g,%.4g", (double)curve->point_x[i] / Q16_ONE, (double)curve->point_y[i] / Q16_ONE);
+
         break;
     }
 
-    *x = (int)(vec2d_ouput.x * (float)current_state.deadzone_scale);
-    *y = (int)(vec2d_ouput.y * (float)current_state.deadzone_scale);
+    printf("\n");
+}
+
+
+static const analog_curve *analog_curve_get(int analog)
+{
+    if (analog == ANALOG_RIGHT)
+        return &current_state.right_analog_curve;
+
+    return &current_state.left_analog_curve;
 }
 
+
+static double analog_curve_value(const analog_curve *curve, double magnitude)
+{   // the curve at magnitude, for 0..1.
+    switch(curve->type)
+    {
+    default:
+    case CURVE_LINEAR:
+        return magnitude;
+
+    case CURVE_EXP:
+        // dz_exp without its deadzone, which would cut off below 0.0001.
+        return pow(magnitude, (double)curve->exponent / Q16_ONE);
+
+    case CURVE_S:
+        return magnitude * magnitude * (3.0 - 2.0 * magnitude);
+
+    case CURVE_POINTS:
+        {
+            double last_x = 0.0;
+            double last_y = 0.0;
+
+            for (int i=0; i <= curve->points; i++)
+            {   // the last point is always 1,1.
+                double point_x = 1.0;
+                double point_y = 1.0;
+
+                if (i < curve->points)
+                {
+                    point_x = (double)curve->point_x[i] / Q16_ONE;
+                    point_y = (double)curve->point_y[i] / Q16_ONE;
+                }
+
+                if (magnitude <= point_x)
+                    return last_y + (point_y - last_y) * (magnitude - last_x) / (point_x - last_x);
+
+                last_x = point_x;
+                last_y = point_y;
+            }
+
+            return last_y;
+        }
+    }
+}
+
+
+static void analog_curve_update()
+{
+    for (int analog=0; analog < 2; analog++)
+    {
+        const analog_curve *curve = analog_curve_get(analog == 0 ? ANALOG_LEFT : ANALOG_RIGHT);
+        curve_lut *lut = &analog_curve_lut[analog];
+
+        if (curve->type == CURVE_LINEAR || curve->type == CURVE_POINTS)
+            continue;
+
+        for (int i=0; i < CURVE_LUT_SIZE; i++)
+        {
+            double root = (double)i / (double)(CURVE_LUT_SIZE - 1);
+            double magnitude = root * root;
+
+            lut->value[i] = (Sint32)lround(analog_curve_value(curve, magnitude) * (double)(1 << 24));
+        }
+    }
+}
+
+
+static Sint64 analog_curve_points(const analog_curve *curve, Sint64 magnitude)
+{   // analog_curve_value for CURVE_POINTS, magnitude and the result have 24 fractional bits.
+    Sint64 last_x = 0;
+    Sint64 last_y = 0;
+
+    for (int i=0; i <= curve->points; i++)
+    {   // the last point is always 1,1.
+        Sint64 point_x = Q16_ONE;
+        Sint64 point_y = Q16_ONE;
+
+        if (i < curve->points)
+        {
+            point_x = curve->point_x[i];
+            point_y = curve->point_y[i];
+        }
+
+        if (magnitude <= point_x * 256)
+            return last_y * 256 + ((point_y - last_y) * (magnitude - last_x * 256)) / (point_x - last_x);
+
+        last_x = point_x;
+        last_y = point_y;
+    }
+
+    return last_y * 256;
+}
+
+
+static Sint64 analog_curve_fetch(const analog_curve *curve, const curve_lut *lut, Sint64 magnitude, int frac_bits)
+{   // magnitude has frac_bits fractional bits, 24 or 30, the result has 24.
+    if (magnitude >= ((Sint64)1 << frac_bits))
+    {
+        Sint64 value = lut->value[CURVE_LUT_SIZE - 1];
+
+        if (curve->type == CURVE_POINTS)
+            value = analog_curve_points(curve, 1 << 24);
+
+        return (value * magnitude) >> frac_bits;
+    }
+
+    if (curve->type == CURVE_POINTS)
+        return analog_curve_points(curve, magnitude >> (frac_bits - 24));
+
+    Sint64 root = dz_isqrt(magnitude << (48 - frac_bits));
+    int index = (int)(root >> CURVE_LUT_STEP_BITS);
+    Sint64 frac = root & ((1 << CURVE_LUT_STEP_BITS) - 1);
+
+    return lut->value[index] + (((Sint64)(lut->value[index + 1] - lut->value[index]) * frac) >> CURVE_LUT_STEP_BITS);
+}
+
+
+void deadzone_update()
+{   // get the tables or fixed point deadzone ready for the current settings.
+    int mode = current_state.deadzone_mode;
+    double dz = (double)(current_state.deadzone_x) / 32768.0;
+    double scale = (double)current_state.deadzone_scale;
+    bool axis_scaled = (mode == DZ_SLOPED_SCALED_AXIAL || mode == DZ_HYBRID);
+
+    deadzone_q16_set(&dz_q16, current_state.deadzone_x);
+    analog_curve_update();
+
+    dz_lut.valid = false;
+
+    if (current_state.deadzone_math != DZM_TABLE)
+        return;
+
+    dz_lut.axis_deadzone = -1;
+    dz_lut.radial_deadzone = 0;
+    dz_lut.radial_scaled = (mode == DZ_SCALED_RADIAL || mode == DZ_HYBRID);
+
+    if (mode == DZ_DEFAULT || mode == DZ_AXIAL)
+        dz_lut.axis_deadzone = current_state.deadzone_x;
+
+    if (mode == DZ_RADIAL || mode == DZ_SCALED_RADIAL || mode == DZ_HYBRID)
+        dz_lut.radial_deadzone = dz_q16.radial / 4;
+
+    for (int i=0; i < DZ_LUT_SIZE; i++)
+    {
+        double value = (double)((Sint64)i << DZ_LUT_STEP_BITS) / (double)(32768 << DZ_LUT_FRAC);
+
+        if (dz_lut.radial_scaled)
+        {   /* map_range(magnitude, dz, 1.0, 0.0, 1.0) / magnitude, the first
+             * entry is always inside the deadzone so it just copies the next.
+             */
+            double magnitude = (i == 0 ? (double)(1 << DZ_LUT_STEP_BITS) / (double)(32768 << DZ_LUT_FRAC) : value);
+
+            dz_lut.radial[i] = dz_lut_value((magnitude - dz) / ((1.0 - dz) * magnitude), (double)(1 << 24));
+        }
+
+        if (!axis_scaled)
+        {
+            dz_lut.axis[i] = dz_lut_value(value, scale * DEADZONE_ONE);
+        }
+        else if (dz >= 1.0)
+        {   // the float version never gets past the deadzone.
+            dz_lut.axis[i] = 0;
+        }
+        else
+        {   // map_range(value, dz * value, 1.0, 0.0, 1.0)
+            dz_lut.axis[i] = dz_lut_value(value * (1.0 - dz) / (1.0 - dz * value), scale * DEADZONE_ONE);
+        }
+    }
+
+    dz_lut.valid = dz_lut_check();
+
+    if (!dz_lut.valid)
+        printf("deadzone: using the float version for %s with deadzone %d\n",
+            deadzone_mode_str(mode), current_state.deadzone_x);
+}
+
+
+void deadzone_mouse_calc(int *x, int *y, int in_x, int in_y)
+{
+    if (current_state.deadzone_math == DZM_FIXED)
+        deadzone_mouse_calc_fixed(x, y, in_x, in_y);
+
+    else if (dz_lut.valid)
+        dz_lut_calc(x, y, in_x, in_y);
+
+    else
+        deadzone_mouse_calc_float(x, y, in_x, in_y);
+}
+
+
+void deadzone_analog_calc_float(int analog, int *x, int *y, int in_x, int in_y)
+{   // the reference version of deadzone_analog_calc.
+    const analog_curve *curve = analog_curve_get(analog);
+    vector2d vec2d_ouput;
+
+    if (curve->type == CURVE_LINEAR)
+    {
+        deadzone_mouse_calc_float(x, y, in_x, in_y);
+        return;
+    }
+
+    deadzone_calc_float(&vec2d_ouput, in_x, in_y);
+
+    double magnitude = vector2d_magnitude(&vec2d_ouput);
+    double value;
+
+    if (magnitude <= 0.0)
+    {
+        *x = *y = 0;
+        return;
+    }
+
+    if (magnitude >= 1.0)
+        value = analog_curve_value(curve, 1.0) * magnitude;
+    else
+        value = analog_curve_value(curve, magnitude);
+
+    *x = (int)(vec2d_ouput.x * (value / magnitude) * (double)current_state.deadzone_scale * DEADZONE_ONE);
+    *y = (int)(vec2d_ouput.y * (value / magnitude) * (double)current_state.deadzone_scale * DEADZONE_ONE);
+}
+
+
+void deadzone_analog_calc(int analog, int *x, int *y, int in_x, int in_y)
+{   // deadzone_mouse_calc with the stick's response curve.
+    const analog_curve *curve = analog_curve_get(analog);
+    Sint64 value_x, value_y;
+
+    if (curve->type == CURVE_LINEAR)
+    {
+        deadzone_mouse_calc(x, y, in_x, in_y);
+        return;
+    }
+
+    if (current_state.deadzone_math == DZM_FLOAT)
+    {
+        deadzone_analog_calc_float(analog, x, y, in_x, in_y);
+        return;
+    }
+
+    // the curve needs the deadzone before deadzone_scale, which the tables don't have.
+    int frac_bits = 24;
+
+    deadzone_calc_fixed_frac(&value_x, &value_y, in_x, in_y, frac_bits);
+
+    if (value_x > -(1 << 22) && value_x < (1 << 22) && value_y > -(1 << 22) && value_y < (1 << 22))
+    {   /* below 0.25 the curves can be steep enough that 24 bits is not
+         * enough at large deadzone_scale, and 30 bits can't overflow.
+         */
+        frac_bits = 30;
+        deadzone_calc_fixed_frac(&value_x, &value_y, in_x, in_y, frac_bits);
+    }
+
+    Sint64 magnitude = dz_isqrt(value_x * value_x + value_y * value_y);
+
+    if (magnitude == 0)
+    {
+        *x = *y = 0;
+        return;
+    }
+
+    Sint64 value = analog_curve_fetch(curve, &analog_curve_lut[analog == ANALOG_RIGHT ? 1 : 0], magnitude, frac_bits);
+
+    // scale the vector from magnitude to value.
+    Sint64 out_x = (value_x * value) / magnitude;
+    Sint64 out_y = (value_y * value) / magnitude;
+
+    *x = (int)((out_x * current_state.deadzone_scale * DEADZONE_ONE) / (1 << 24));
+    *y = (int)((out_y * current_state.deadzone_scale * DEADZONE_ONE) / (1 << 24));
+}
@@ -0,0 +1,793 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Compiled config cache.
+ *
+ * After the config files have been parsed and finalised we write out the
+ * result: the gptokeyb_config list, custom charsets, wordsets and the
+ * [config] settings. Pointers are stored as offsets into a string table or
+ * indexes into the config list. Loading maps the image, checks it, and then
+ * rebuilds the configs from it with config_create and register_*, which is
+ * still much quicker than parsing the files. Nothing points into the image
+ * once it has been loaded.
+ *
+ * Each set of config files gets its own cache file, the header holds a key
+ * made from the files' mtime, size and contents, the game prefix and the
+ * environment variables that change how the files are parsed. If anything
+ * differs the files are parsed as normal and the cache is rewritten.
+ */
+
+#define CACHE_MAGIC "GPTK2CC"
+#define CACHE_VERSION 5
+#define CACHE_NULL 0xFFFFFFFFu
+
+typedef struct
+{
+    Sint32 type;
+    Sint32 exponent;
+    Sint32 points;
+    Sint32 point_x[CURVE_POINTS_MAX];
+    Sint32 point_y[CURVE_POINTS_MAX];
+} cache_curve;
+
+typedef struct
+{   // the gptokeyb_state fields that can be set from a [config] section.
+    Sint32 repeat_delay;
+    Sint32 repeat_rate;
+    Sint32 kernel_repeat;
+    Sint32 mouse_delay;
+    Sint32 mouse_rate;
+    Sint32 mouse_slow_scale;
+    Sint32 deadzone_mode;
+    Sint32 deadzone_math;
+    Sint32 deadzone_scale;
+    Sint32 deadzone_x;
+    Sint32 deadzone_y;
+    Sint32 deadzone_triggers;
+    cache_curve left_analog_curve;
+    cache_curve right_analog_curve;
+    Sint32 dpad_mouse_normalize;
+    Sint32 absolute_center_x;
+    Sint32 absolute_center_y;
+    Sint32 absolute_step;
+    Sint32 absolute_deadzone;
+    Sint32 absolute_rotate;
+} cache_state;
+
+typedef struct
+{
+    Sint32 keycode;
+    Sint32 modifier;
+    Sint32 repeat;
+    Sint32 action;
+    Sint32 special;
+    Uint32 cfg_name;  // string offset
+    Sint32 cfg_map;   // config index, -1 for none
+} cache_button;
+
+typedef struct
+{
+    Uint32 name;
+    Uint32 charset;
+    Uint32 wordset;
+
+    Sint32 overlay_mode;
+    Sint32 exclusive_mode;
+
+    Sint32 left_analog_as_mouse;
+    Sint32 right_analog_as_mouse;
+    Sint32 dpad_as_mouse;
+    Sint32 left_analog_as_absolute_mouse;
+    Sint32 right_analog_as_absolute_mouse;
+
+    Uint32 mouse_wheel_amount;
+
+    cache_button button[GBTN_MAX];
+} cache_config;
+
+typedef struct
+{
+    Uint32 name;
+    Uint32 characters;
+} cache_char_set;
+
+typedef struct
+{
+    Uint32 name;
+    Uint32 first_word;
+    Uint32 words_len;
+} cache_word_set;
+
+typedef struct
+{
+    char magic[8];
+    Uint32 version;
+    Uint32 config_size;
+    Uint64 key;
+    Uint32 size;
+
+    Uint32 config_count;
+    Uint32 char_set_count;
+    Uint32 word_set_count;
+    Uint32 word_count;
+    Uint32 strings_size;
+
+    Uint32 default_control_name;
+    cache_state state;
+} cache_header;
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t alloc;
+} cache_buffer;
+
+
+static Uint64 cache_hash(Uint64 hash, const void *data, size_t size)
+{   // 64 bit FNV-1a
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (size_t i=0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+
+static Uint64 cache_hash_string(Uint64 hash, const char *string)
+{   // includes the terminator so "ab" + "c" and "a" + "bc" differ.
+    if (string == NULL)
+        string = "";
+
+    return cache_hash(hash, string, strlen(string) + 1);
+}
+
+
+static Uint64 cache_hash_file(Uint64 hash, const char *file_name)
+{
+    struct stat file_stat;
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &file_stat) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+
+        return cache_hash_string(hash, "(missing)");
+    }
+
+    Sint64 file_info[3] = {
+        (Sint64)file_stat.st_size,
+        (Sint64)file_stat.st_mtim.tv_sec,
+        (Sint64)file_stat.st_mtim.tv_nsec,
+        };
+
+    hash = cache_hash(hash, file_info, sizeof(file_info));
+
+    if (file_stat.st_size > 0)
+    {
+        void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            hash = cache_hash(hash, data, file_stat.st_size);
+            munmap(data, file_stat.st_size);
+        }
+    }
+
+    close(fd);
+    return hash;
+}
+
+
+static Uint64 cache_identity()
+{   // which cache file to use, one per set of config files.
+    Uint64 hash = 14695981039346656037ull;
+
+    for (int i=0; i < config_file_count; i++)
+    {
+        hash = cache_hash_string(hash, config_files[i].file_name);
+        hash = cache_hash_string(hash, config_files[i].game_prefix);
+    }
+
+    hash = cache_hash_string(hash, user_config_file);
+    hash = cache_hash_string(hash, game_prefix);
+
+    return hash;
+}
+
+
+static Uint64 cache_key()
+{   // everything that can change the result of loading the configs.
+    Uint64 hash = cache_identity();
+    Sint32 hotkey_gbtn = current_state.hotkey_gbtn;
+
+    hash = cache_hash_string(hash, GPTK2_VERSION);
+    hash = cache_hash(hash, &hotkey_gbtn, sizeof(hotkey_gbtn));
+    hash = cache_hash_string(hash, SDL_getenv("TEXTINPUTINTERACTIVE"));
+
+    for (int i=0; i < config_file_count; i++)
+        hash = cache_hash_file(hash, config_files[i].file_name);
+
+    hash = cache_hash_file(hash, user_config_file);
+
+    return hash;
+}
+
+
+static bool cache_dir(char *path, size_t path_size)
+{   // $XDG_CACHE_HOME/gptokeyb2 or ~/.cache/gptokeyb2
+    const char *env_cache = SDL_getenv("XDG_CACHE_HOME");
+    const char *env_home = SDL_getenv("HOME");
+
+    if (env_cache != NULL && env_cache[0] == '/')
+        snprintf(path, path_size, "%s/gptokeyb2", env_cache);
+
+    else if (env_home != NULL && env_home[0] == '/')
+        snprintf(path, path_size, "%s/.cache/gptokeyb2", env_home);
+
+    else
+        return false;
+
+    return true;
+}
+
+
+static bool cache_path(char *path, size_t path_size)
+{
+    char dir[MAX_PATH];
+
+    if (!cache_dir(dir, sizeof(dir)))
+        return false;
+
+    snprintf(path, path_size, "%s/%016" PRIx64 ".cache", dir, cache_identity());
+    return true;
+}
+
+
+static Uint32 cache_buffer_add(cache_buffer *buffer, const void *data, size_t size)
+{   // append data, returns its offset.
+    if (buffer->size + size > buffer->alloc)
+    {
+        size_t new_alloc = (buffer->alloc == 0) ? 4096 : buffer->alloc;
+
+        while (buffer->size + size > new_alloc)
+            new_alloc *= 2;
+
+        buffer->data = (char *)gptk_realloc(buffer->data, buffer->alloc, new_alloc);
+        buffer->alloc = new_alloc;
+    }
+
+    Uint32 offset = (Uint32)buffer->size;
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+
+    return offset;
+}
+
+
+static Uint32 cache_string(cache_buffer *strings, const char *string)
+{
+    if (string == NULL)
+        return CACHE_NULL;
+
+    return cache_buffer_add(strings, string, strlen(string) + 1);
+}
+
+
+static Sint32 cache_config_index(const gptokeyb_config *config)
+{
+    Sint32 index = 0;
+
+    for (const gptokeyb_config *current = root_config; current != NULL; current = current->next, index++)
+    {
+        if (current == config)
+            return index;
+    }
+
+    return -1;
+}
+
+
+static void cache_save_curve(cache_curve *cached, const analog_curve *curve)
+{
+    cached->type     = curve->type;
+    cached->exponent = curve->exponent;
+    cached->points   = curve->points;
+
+    for (int i=0; i < CURVE_POINTS_MAX; i++)
+    {
+        cached->point_x[i] = curve->point_x[i];
+        cached->point_y[i] = curve->point_y[i];
+    }
+}
+
+
+static void cache_load_curve(analog_curve *curve, const cache_curve *cached)
+{
+    curve->type     = cached->type;
+    curve->exponent = cached->exponent;
+    curve->points   = cached->points;
+
+    for (int i=0; i < CURVE_POINTS_MAX; i++)
+    {
+        curve->point_x[i] = cached->point_x[i];
+        curve->point_y[i] = cached->point_y[i];
+    }
+}
+
+
+static void cache_save_state(cache_state *state)
+{
+    state->repeat_delay         = (Sint32)current_state.repeat_delay;
+    state->repeat_rate          = (Sint32)current_state.repeat_rate;
+    state->kernel_repeat        = current_state.kernel_repeat;
+    state->mouse_delay          = (Sint32)current_state.mouse_delay;
+    state->mouse_rate           = current_state.mouse_rate;
+    state->mouse_slow_scale     = current_state.mouse_slow_scale;
+    state->deadzone_mode        = current_state.deadzone_mode;
+    state->deadzone_math        = current_state.deadzone_math;
+    state->deadzone_scale       = current_state.deadzone_scale;
+    state->deadzone_x           = current_state.deadzone_x;
+    state->deadzone_y           = current_state.deadzone_y;
+    state->deadzone_triggers    = current_state.deadzone_triggers;
+    cache_save_curve(&state->left_analog_curve, &current_state.left_analog_curve);
+    cache_save_curve(&state->right_analog_curve, &current_state.right_analog_curve);
+    state->dpad_mouse_normalize = current_state.dpad_mouse_normalize;
+    state->absolute_center_x    = current_state.absolute_center_x;
+    state->absolute_center_y    = current_state.absolute_center_y;
+    state->absolute_step        = current_state.absolute_step;
+    state->absolute_deadzone    = current_state.absolute_deadzone;
+    state->absolute_rotate      = current_state.absolute_rotate;
+}
+
+
+static void cache_load_state(const cache_state *state)
+{
+    current_state.repeat_delay         = state->repeat_delay;
+    current_state.repeat_rate          = state->repeat_rate;
+    current_state.kernel_repeat        = (state->kernel_repeat != 0);
+    current_state.mouse_delay          = state->mouse_delay;
+    current_state.mouse_rate           = state->mouse_rate;
+    current_state.mouse_slow_scale     = state->mouse_slow_scale;
+    current_state.deadzone_mode        = state->deadzone_mode;
+    current_state.deadzone_math        = state->deadzone_math;
+    current_state.deadzone_scale       = state->deadzone_scale;
+    current_state.deadzone_x           = state->deadzone_x;
+    current_state.deadzone_y           = state->deadzone_y;
+    current_state.deadzone_triggers    = state->deadzone_triggers;
+    cache_load_curve(&current_state.left_analog_curve, &state->left_analog_curve);
+    cache_load_curve(&current_state.right_analog_curve, &state->right_analog_curve);
+    current_state.dpad_mouse_normalize = (state->dpad_mouse_normalize != 0);
+    current_state.absolute_center_x    = state->absolute_center_x;
+    current_state.absolute_center_y    = state->absolute_center_y;
+    current_state.absolute_step        = state->absolute_step;
+    current_state.absolute_deadzone    = state->absolute_deadzone;
+    current_state.absolute_rotate      = state->absolute_rotate;
+}
+
+
+void config_cache_save()
+{   // write out the finalised configs.
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH + 32];
+
+    if (!cache_path(path, sizeof(path)))
+        return;
+
+    cache_header header;
+    cache_buffer configs = {0};
+    cache_buffer char_sets = {0};
+    cache_buffer word_sets = {0};
+    cache_buffer words = {0};
+    cache_buffer strings = {0};
+
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.config_size = sizeof(cache_config);
+    header.key = cache_key();
+
+    cache_save_state(&header.state);
+    header.default_control_name = cache_string(&strings, default_control_name);
+
+    for (gptokeyb_config *current = root_config; current != NULL; current = current->next)
+    {
+        cache_config config;
+
+        memset(&config, 0, sizeof(config));
+
+        config.name    = cache_string(&strings, current->name);
+        config.charset = cache_string(&strings, current->charset);
+        config.wordset = cache_string(&strings, current->wordset);
+
+        config.overlay_mode   = current->overlay_mode;
+        config.exclusive_mode = current->exclusive_mode;
+
+        config.left_analog_as_mouse           = current->left_analog_as_mouse;
+        config.right_analog_as_mouse          = current->right_analog_as_mouse;
+        config.dpad_as_mouse                  = current->dpad_as_mouse;
+        config.left_analog_as_absolute_mouse  = current->left_analog_as_absolute_mouse;
+        config.right_analog_as_absolute_mouse = current->right_analog_as_absolute_mouse;
+
+        config.mouse_wheel_amount = current->mouse_wheel_amount;
+
+        for (int btn=0; btn < GBTN_MAX; btn++)
+        {
+            const gptokeyb_button *button = &current->button[btn];
+
+            config.button[btn].keycode  = button->keycode;
+            config.button[btn].modifier = button->modifier;
+            config.button[btn].repeat   = button->repeat;
+            config.button[btn].action   = button->action;
+            config.button[btn].special  = button->special;
+            config.button[btn].cfg_name = cache_string(&strings, button->cfg_name);
+            config.button[btn].cfg_map  = (button->cfg_map != NULL) ? cache_config_index(button->cfg_map) : -1;
+        }
+
+        cache_buffer_add(&configs, &config, sizeof(config));
+        header.config_count++;
+    }
+
+    for (char_set *current = root_char_set; current != NULL; current = current->next)
+    {   // builtin charsets are already there.
+        if (current->builtin)
+            continue;
+
+        cache_char_set set;
+
+        set.name       = cache_string(&strings, current->name);
+        set.characters = cache_string(&strings, current->characters);
+
+        cache_buffer_add(&char_sets, &set, sizeof(set));
+        header.char_set_count++;
+    }
+
+    for (word_set *current = root_word_set; current != NULL; current = current->next)
+    {
+        cache_word_set set;
+
+        set.name       = cache_string(&strings, current->name);
+        set.first_word = header.word_count;
+        set.words_len  = current->words_len;
+
+        for (size_t i=0; i < current->words_len; i++)
+        {
+            Uint32 word = cache_string(&strings, current->words[i]);
+
+            cache_buffer_add(&words, &word, sizeof(word));
+            header.word_count++;
+        }
+
+        cache_buffer_add(&word_sets, &set, sizeof(set));
+        header.word_set_count++;
+    }
+
+    header.strings_size = strings.size;
+    header.size = sizeof(header) + configs.size + char_sets.size + word_sets.size + words.size + strings.size;
+
+    // write to a temp file and move it into place, so nobody sees half a cache.
+    char dir[MAX_PATH];
+
+    cache_dir(dir, sizeof(dir));
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+
+    if (access(dir, F_OK) != 0)
+    {
+        char parent[MAX_PATH];
+
+        strncpy(parent, dir, sizeof(parent) - 1);
+        parent[sizeof(parent) - 1] = '\0';
+
+        char *slash = strrchr(parent, '/');
+        if (slash != NULL && slash != parent)
+        {
+            *slash = '\0';
+            mkdir(parent, 0755);
+        }
+
+        mkdir(dir, 0755);
+    }
+
+    FILE *fp = fopen(temp_path, "wb");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Unable to write config cache '%s': %s\n", temp_path, strerror(errno));
+    }
+    else
+    {
+        bool written = (
+            fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(configs.data, 1, configs.size, fp) == configs.size &&
+            fwrite(char_sets.data, 1, char_sets.size, fp) == char_sets.size &&
+            fwrite(word_sets.data, 1, word_sets.size, fp) == word_sets.size &&
+            fwrite(words.data, 1, words.size, fp) == words.size &&
+            fwrite(strings.data, 1, strings.size, fp) == strings.size);
+
+        if (fclose(fp) != 0)
+            written = false;
+
+        if (!written || rename(temp_path, path) != 0)
+        {
+            fprintf(stderr, "Unable to write config cache '%s': %s\n", path, strerror(errno));
+            unlink(temp_path);
+        }
+    }
+
+    free(configs.data);
+    free(char_sets.data);
+    free(word_sets.data);
+    free(words.data);
+    free(strings.data);
+}
+
+
+static bool cache_check_string(const cache_header *header, Uint32 offset)
+{
+    return (offset == CACHE_NULL || offset < header->strings_size);
+}
+
+
+static bool cache_check_range(Sint32 value, Sint32 min, Sint32 max)
+{
+    return (value >= min && value <= max);
+}
+
+
+static bool cache_check_curve(const cache_curve *curve)
+{
+    return (cache_check_range(curve->type, CURVE_LINEAR, CURVE_POINTS) &&
+        cache_check_range(curve->points, 0, CURVE_POINTS_MAX));
+}
+
+
+static bool cache_check_button(const cache_header *header, const cache_button *button, Sint32 config_index)
+{   // the enums are used to index tables, and state changes need somewhere to go.
+    if (!cache_check_string(header, button->cfg_name) ||
+        !cache_check_range(button->cfg_map, -1, (Sint32)header->config_count - 1) ||
+        !cache_check_range(button->keycode, 0, KEY_MAX) ||
+        !cache_check_range(button->modifier, 0, MOD_SHIFT | MOD_CTRL | MOD_ALT) ||
+        !cache_check_range(button->action, ACT_NONE, ACT_STATE_SET) ||
+        !cache_check_range(button->special, SPC_NONE, SPC_CANCEL_INPUT))
+        return false;
+
+    if (button->action >= ACT_STATE_HOLD && (button->cfg_map < 0 || button->cfg_map == config_index))
+        return false;
+
+    return true;
+}
+
+
+static bool cache_check(const void *data, size_t size)
+{   // make sure the whole image is sane before we touch anything.
+    const cache_header *header = (const cache_header *)data;
+
+    if (size < sizeof(cache_header))
+        return false;
+
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CACHE_VERSION ||
+        header->config_size != sizeof(cache_config) ||
+        header->size != size ||
+        header->key != cache_key())
+        return false;
+
+    Uint64 expected_size = (Uint64)sizeof(cache_header)
+        + (Uint64)header->config_count * sizeof(cache_config)
+        + (Uint64)header->char_set_count * sizeof(cache_char_set)
+        + (Uint64)header->word_set_count * sizeof(cache_word_set)
+        + (Uint64)header->word_count * sizeof(Uint32)
+        + (Uint64)header->strings_size;
+
+    if (expected_size != size || header->config_count == 0)
+        return false;
+
+    const char *strings = (const char *)data + size - header->strings_size;
+
+    if (header->strings_size > 0 && strings[header->strings_size - 1] != '\0')
+        return false;
+
+    const cache_config *configs = (const cache_config *)(header + 1);
+    const cache_char_set *char_sets = (const cache_char_set *)(configs + header->config_count);
+    const cache_word_set *word_sets = (const cache_word_set *)(char_sets + header->char_set_count);
+    const Uint32 *words = (const Uint32 *)(word_sets + header->word_set_count);
+
+    if (!cache_check_string(header, header->default_control_name))
+        return false;
+
+    if (!cache_check_range(header->state.deadzone_mode, DZ_DEFAULT, DZ_HYBRID) ||
+        !cache_check_range(header->state.deadzone_math, DZM_TABLE, DZM_FLOAT) ||
+        !cache_check_curve(&header->state.left_analog_curve) ||
+        !cache_check_curve(&header->state.right_analog_curve))
+        return false;
+
+    for (Uint32 i=0; i < header->config_count; i++)
+    {
+        if (configs[i].name == CACHE_NULL ||
+            !cache_check_string(header, configs[i].name) ||
+            !cache_check_string(header, configs[i].charset) ||
+            !cache_check_string(header, configs[i].wordset) ||
+            !cache_check_range(configs[i].overlay_mode, OVL_NONE, OVL_CLEAR) ||
+            !cache_check_range(configs[i].exclusive_mode, EXL_FALSE, EXL_PARENT))
+            return false;
+
+        for (int btn=0; btn < GBTN_MAX; btn++)
+        {
+            if (!cache_check_button(header, &configs[i].button[btn], (Sint32)i))
+                return false;
+        }
+    }
+
+    for (Uint32 i=0; i < header->char_set_count; i++)
+    {
+        if (char_sets[i].name == CACHE_NULL || char_sets[i].characters == CACHE_NULL ||
+            !cache_check_string(header, char_sets[i].name) ||
+            !cache_check_string(header, char_sets[i].characters))
+            return false;
+    }
+
+    for (Uint32 i=0; i < header->word_set_count; i++)
+    {
+        if (word_sets[i].name == CACHE_NULL ||
+            !cache_check_string(header, word_sets[i].name) ||
+            (Uint64)word_sets[i].first_word + word_sets[i].words_len > header->word_count)
+            return false;
+    }
+
+    for (Uint32 i=0; i < header->word_count; i++)
+    {
+        if (words[i] == CACHE_NULL || !cache_check_string(header, words[i]))
+            return false;
+    }
+
+    return true;
+}
+
+
+static const char *cache_get_string(const char *strings, Uint32 offset)
+{
+    if (offset == CACHE_NULL)
+        return NULL;
+
+    return string_register(strings + offset);
+}
+
+
+bool config_cache_load()
+{   // load the configs from the cache, returns false if it is missing or out of date.
+    char path[MAX_PATH];
+
+    if (!cache_path(path, sizeof(path)))
+        return false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size < (off_t)sizeof(cache_header))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = file_stat.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    if (!cache_check(data, size))
+    {
+        munmap(data, size);
+        return false;
+    }
+
+    const cache_header *header = (const cache_header *)data;
+    const cache_config *configs = (const cache_config *)(header + 1);
+    const cache_char_set *char_sets = (const cache_char_set *)(configs + header->config_count);
+    const cache_word_set *word_sets = (const cache_word_set *)(char_sets + header->char_set_count);
+    const Uint32 *words = (const Uint32 *)(word_sets + header->word_set_count);
+    const char *strings = (const char *)data + size - header->strings_size;
+
+    cache_load_state(&header->state);
+    deadzone_update();
+
+    const char *control_name = cache_get_string(strings, header->default_control_name);
+    if (control_name != NULL)
+        strncpy(default_control_name, control_name, MAX_CONTROL_NAME - 1);
+
+    for (Uint32 i=0; i < header->char_set_count; i++)
+    {
+        register_char_set(
+            strings + char_sets[i].name,
+            strings + char_sets[i].characters);
+    }
+
+    // wordsets are kept most recently used first, so add them in reverse to keep the order.
+    for (Uint32 i=header->word_set_count; i > 0; i--)
+    {
+        const cache_word_set *set = &word_sets[i-1];
+
+        for (Uint32 word=0; word < set->words_len; word++)
+        {
+            register_word_set(strings + set->name, strings + words[set->first_word + word]);
+        }
+    }
+
+    gptokeyb_config **config_list = (gptokeyb_config **)gptk_malloc(sizeof(gptokeyb_config *) * header->config_count);
+
+    // the first config is always the root.
+    config_list[0] = root_config;
+
+    for (Uint32 i=1; i < header->config_count; i++)
+        config_list[i] = config_create(strings + configs[i].name);
+
+    for (Uint32 i=0; i < header->config_count; i++)
+    {
+        gptokeyb_config *current = config_list[i];
+        const cache_config *config = &configs[i];
+
+        current->charset = cache_get_string(strings, config->charset);
+        current->wordset = cache_get_string(strings, config->wordset);
+
+        current->overlay_mode   = config->overlay_mode;
+        current->exclusive_mode = config->exclusive_mode;
+
+        current->left_analog_as_mouse           = config->left_analog_as_mouse;
+        current->right_analog_as_mouse          = config->right_analog_as_mouse;
+        current->dpad_as_mouse                  = config->dpad_as_mouse;
+        current->left_analog_as_absolute_mouse  = config->left_analog_as_absolute_mouse;
+        current->right_analog_as_absolute_mouse = config->right_analog_as_absolute_mouse;
+
+        current->mouse_wheel_amount = config->mouse_wheel_amount;
+        current->map_check = false;
+
+        for (int btn=0; btn < GBTN_MAX; btn++)
+        {
+            gptokeyb_button *button = &current->button[btn];
+
+            button->keycode  = config->button[btn].keycode;
+            button->modifier = config->button[btn].modifier;
+            button->repeat   = (config->button[btn].repeat != 0);
+            button->action   = config->button[btn].action;
+            button->special  = config->button[btn].special;
+            button->cfg_name = cache_get_string(strings, config->button[btn].cfg_name);
+            button->cfg_map  = (config->button[btn].cfg_map >= 0) ? config_list[config->button[btn].cfg_map] : NULL;
+        }
+    }
+
+    free(config_list);
+    munmap(data, size);
+
+    return true;
+}
@@ -0,0 +1,112 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <limits.h>
+#include <time.h>
+
+/* The clock the state machine runs on, 64 bit nanoseconds of
+ * CLOCK_MONOTONIC, so it doesn't wrap and deadlines can be finer than a
+ * millisecond.
+ *
+ * gptokeyb2-bench switches it to a virtual clock that only moves when
+ * told to. A recorded session can then be replayed as fast as the engine
+ * runs, and repeats, typing and mouse movement happen at exactly the same
+ * points every time.
+ */
+
+static bool clock_virtual = false;
+static Uint64 clock_virtual_ns = 0;
+
+
+Uint64 clock_monotonic_ns()
+{   // always the real time, for measuring things.
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (Uint64)now.tv_sec * NS_PER_SEC + (Uint64)now.tv_nsec;
+}
+
+
+Uint64 clock_now()
+{
+    if (clock_virtual)
+        return clock_virtual_ns;
+
+    return clock_monotonic_ns();
+}
+
+
+void clock_delay(Uint64 ns)
+{   // the virtual clock just moves forward.
+    if (clock_virtual)
+    {
+        clock_virtual_ns += ns;
+    }
+    else
+    {
+        struct timespec delay = {
+            .tv_sec = (time_t)(ns / NS_PER_SEC),
+            .tv_nsec = (long)(ns % NS_PER_SEC),
+        };
+
+        while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+
+void clock_set_virtual(Uint64 ns)
+{
+    clock_virtual = true;
+    clock_virtual_ns = ns;
+}
+
+
+void clock_set_real()
+{
+    clock_virtual = false;
+}
+
+
+void clock_advance_to(Uint64 ns)
+{   // the virtual clock never goes backwards.
+    if (clock_virtual && ns > clock_virtual_ns)
+        clock_virtual_ns = ns;
+}
+
+
+Sint64 clock_until(Uint64 deadline, Uint64 now)
+{   // how long until deadline, 0 if it has passed.
+    return (deadline > now ? (Sint64)(deadline - now) : 0);
+}
+
+
+int clock_timeout_ms(Sint64 timeout)
+{   /* Turn a ns timeout into ms for SDL and epoll_wait, rounding up so we
+     * never wake up just before a deadline. -1 stays as wait forever.
+     */
+    if (timeout < 0)
+        return -1;
+
+    Sint64 ms = (timeout + (Sint64)NS_PER_MS - 1) / (Sint64)NS_PER_MS;
+
+    return (ms > INT_MAX ? INT_MAX : (int)ms);
+}
@@ -70,6 +70,15 @@ int config_temp_stack_order_id = 0;
 
 int gptokeyb_config_depth = 0;
 
+// configs hashed by name, see config_find.
+#define CONFIG_HASH_SIZE 64
+gptokeyb_config *config_hash[CONFIG_HASH_SIZE];
+gptokeyb_config *config_last = NULL;
+
+// config files from the command line, loaded by config_load_files.
+config_file config_files[CONFIG_FILES_MAX];
+int config_file_count = 0;
+
 #define GPTK_HK_FIX_MAX 50
 #define GPTK_HK_FIX_MAX_LINE 1024
 char *gptk_hk_fix_text[GPTK_HK_FIX_MAX];
@@ -234,8 +243,19 @@ void config_init()
     root_config = (gptokeyb_config*)gptk_malloc(sizeof(gptokeyb_config));
 
     root_config->name = string_register("controls");
+    root_config->name_key = string_casekey(root_config->name, true);
+
+    for (int i=0; i < CONFIG_HASH_SIZE; i++)
+        config_hash[i] = NULL;
+
+    config_hash[strcasehash(root_config->name) % CONFIG_HASH_SIZE] = root_config;
+    config_last = root_config;
 
     gptokeyb_config_depth = 0;
+    config_temp_stack_order_id = 0;
+
+    default_control_name[0] = '\0';
+    gptk_hk_can_fix = true;
 
     root_config->mouse_wheel_amount = DEFAULT_MOUSE_WHEEL_AMOUNT;
 
@@ -275,6 +295,13 @@ void config_quit()
         config_stack[i] = NULL;
     }
 
+    for (int i=0; i < CONFIG_HASH_SIZE; i++)
+    {
+        config_hash[i] = NULL;
+    }
+
+    config_last = NULL;
+
     for (int i=0; i < gptk_hk_fix_offset; i++)
     {
         free(gptk_hk_fix_text[i]);
@@ -297,14 +324,19 @@ void config_dump()
     printf("[config]\n");
     printf("repeat_delay = %" PRIu64 "\n", current_state.repeat_delay);
     printf("repeat_rate = %" PRIu64 "\n", current_state.repeat_rate);
+    printf("kernel_repeat = %s\n", (current_state.kernel_repeat ? "true" : "false" ));
     // printf("mouse_scale = %d\n", current_state.mouse_scale);
     printf("mouse_delay = %" PRIu64 "\n", current_state.mouse_delay);
+    printf("mouse_rate = %d\n", current_state.mouse_rate);
     printf("mouse_slow_scale = %d\n", current_state.mouse_slow_scale);
     printf("deadzone_mode = %s\n", deadzone_mode_str(current_state.deadzone_mode));
+    printf("deadzone_math = %s\n", deadzone_math_str(current_state.deadzone_math));
     printf("deadzone_scale = %d\n", current_state.deadzone_scale);
     printf("deadzone_x = %d\n", current_state.deadzone_x);
     printf("deadzone_y = %d\n", current_state.deadzone_y);
     printf("deadzone_triggers = %d\n", current_state.deadzone_triggers);
+    analog_curve_dump("left_analog_curve", &current_state.left_analog_curve);
+    analog_curve_dump("right_analog_curve", &current_state.right_analog_curve);
     printf("dpad_mouse_normalize = %s\n", (current_state.dpad_mouse_normalize ? "true" : "false" ));
     printf("absolute_center_x = %d\n", current_state.absolute_center_x);
     printf("absolute_center_y = %d\n", current_state.absolute_center_y);
@@ -606,17 +638,23 @@ gptokeyb_config *config_find(const char *name)
         name=nice_name;
     }
 
-    gptokeyb_config *current = root_config;
+    // names are interned case-folded, if the key doesnt exist neither does the config.
+    const char *name_key = string_casekey(name, false);
+
+    if (name_key == NULL)
+        return NULL;
+
+    gptokeyb_config *current = config_hash[strcasehash(name_key) % CONFIG_HASH_SIZE];
 
     while (current != NULL)
     {
-        if (strcasecmp(current->name, name) == 0)
+        if (current->name_key == name_key)
         {
             // GPTK2_DEBUG("config_find: found %s\n", name);
             return current;
         }
 
-        current = current->next;
+        current = current->hash_next;
     }
 
     // GPTK2_DEBUG("config_find: unable to find %s\n", name);
@@ -646,12 +684,15 @@ gptokeyb_config *config_create(const char *name)
         result->name = string_register(name);
     }
 
+    result->name_key = string_casekey(result->name, true);
+
     // add it to the linked list.
-    gptokeyb_config *last_config = root_config;
-    while (last_config->next != NULL)
-        last_config = last_config->next;
+    config_last->next = result;
+    config_last = result;
 
-    last_config->next = result;
+    Uint32 bucket = strcasehash(result->name_key) % CONFIG_HASH_SIZE;
+    result->hash_next = config_hash[bucket];
+    config_hash[bucket] = result;
 
     // GPTK2_DEBUG("config_create: %s\n", result->name);
     return result;
@@ -667,15 +708,33 @@ void set_cfg_config(const char *name, const char *value, token_ctx *token_state)
     else if (strcasecmp(name, "repeat_rate") == 0)
         current_state.repeat_rate = atoi_between(value, 16, 3000, SDL_DEFAULT_REPEAT_INTERVAL);
 
+    else if (strcasecmp(name, "kernel_repeat") == 0)
+        current_state.kernel_repeat = atob_default(value, true);
+
     else if (strcasecmp(name, "mouse_slow_scale") == 0)
         current_state.mouse_slow_scale = atoi_between(value, 1, 100, 50);
 
     else if (strcasecmp(name, "deadzone_mode") == 0)
         current_state.deadzone_mode = deadzone_get_mode(value);
 
+    else if (strcasecmp(name, "deadzone_math") == 0)
+        current_state.deadzone_math = deadzone_get_math(value);
+
     else if (strcasecmp(name, "deadzone_scale") == 0)
         current_state.deadzone_scale = atoi_between(value, 1, 32768, 512);
 
+    else if (strcasecmp(name, "left_analog_curve") == 0)
+        analog_curve_parse(&current_state.left_analog_curve, value, token_state);
+
+    else if (strcasecmp(name, "right_analog_curve") == 0)
+        analog_curve_parse(&current_state.right_analog_curve, value, token_state);
+
+    else if (strcasecmp(name, "analog_curve") == 0)
+    {
+        analog_curve_parse(&current_state.left_analog_curve, value, token_state);
+        current_state.right_analog_curve = current_state.left_analog_curve;
+    }
+
     else if (strcasecmp(name, "absolute_center_x") == 0)
         current_state.absolute_center_x = atoi_between(value, 1, 7680, 320);
 
@@ -712,6 +771,9 @@ void set_cfg_config(const char *name, const char *value, token_ctx *token_state)
     else if (strcasecmp(name, "mouse_delay") == 0)
         current_state.mouse_delay = atoi_between(value, 16, 3000, SDL_DEFAULT_REPEAT_DELAY);
 
+    else if (strcasecmp(name, "mouse_rate") == 0)
+        current_state.mouse_rate = atoi_between(value, 0, 1000, 0);
+
     else if (strcasecmp(name, "deadzone_delay") == 0)
         ((void)0);
 
@@ -1531,6 +1593,98 @@ int config_load(const char *file_name, bool config_only)
 }
 
 
+void config_add_file(const char *file_name)
+{   // remember a config file to load, along with the game prefix at the time it was given.
+    if (config_file_count >= CONFIG_FILES_MAX)
+    {
+        fprintf(stderr, "Too many config files, ignoring '%s'\n", file_name);
+        return;
+    }
+
+    config_file *file = &config_files[config_file_count++];
+
+    strncpy(file->file_name, file_name, MAX_PATH - 1);
+    strncpy(file->game_prefix, game_prefix, MAX_PROCESS_NAME - 1);
+}
+
+
+void config_load_files()
+{   // load the config files from the command line in order.
+    char saved_game_prefix[MAX_PROCESS_NAME];
+
+    strncpy(saved_game_prefix, game_prefix, MAX_PROCESS_NAME);
+
+    for (int i=0; i < config_file_count; i++)
+    {
+        strncpy(game_prefix, config_files[i].game_prefix, MAX_PROCESS_NAME);
+        config_load(config_files[i].file_name, false);
+    }
+
+    strncpy(game_prefix, saved_game_prefix, MAX_PROCESS_NAME);
+}
+
+
+int config_load_all(bool use_cache, bool user_config)
+{   /* Load the config files and the users config, then finalise them.
+     *
+     * If use_cache is set the compiled cache is used if it is up to date, and updated if not.
+     * Returns non zero if the user config failed to load.
+     */
+    if (use_cache && config_cache_load())
+        return 0;
+
+    config_load_files();
+
+    if (user_config && access(user_config_file, F_OK) == 0)
+    {
+        printf("Loading '%s'\n", user_config_file);
+
+        if (config_load(user_config_file, true))
+            return 1;
+    }
+
+    config_finalise();
+
+    if (use_cache)
+        config_cache_save();
+
+    return 0;
+}
+
+
+void config_select_default(const char *control_name)
+{   // pick the starting control, from the config files or control_name.
+    default_config = NULL;
+
+    if (strlen(default_control_name) > 0)
+    {
+        default_config = config_find(default_control_name);
+
+        if (default_config == NULL)
+        {
+            fprintf(stderr, "Unable to find control '%s'\n", default_control_name);
+        }
+    }
+
+    if (default_config == NULL && strlen(control_name) > 0)
+    {
+        default_config = config_find(control_name);
+
+        if (default_config == NULL)
+        {
+            fprintf(stderr, "Unable to find control '%s'\n", control_name);
+        }
+    }
+
+    if (default_config == NULL)
+    {
+        default_config = root_config;
+    }
+
+    config_stack[0] = default_config;
+}
+
+
 void config_finalise()
 {   // this will check all the configs loaded and link the cfg_name to cfg_maps
     gptokeyb_config *current = root_config;
@@ -1656,4 +1810,7 @@ void config_finalise()
 
         current = current->next;
     }
+
+    // the [config] settings are all in now.
+    deadzone_update();
 }
@@ -0,0 +1,587 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Daemon mode.
+ *
+ * Instead of starting gptokeyb2 for every game, start it once with -D and it
+ * keeps SDL and the uinput devices around. Launch scripts then tell it what
+ * to do over a unix socket, one command per line, arguments are split the
+ * same way as config values so they can be quoted:
+ *
+ *   load "game.gptk" ["other.ini" ...]  - load these config files
+ *   prefix "game"                        - game prefix used by the next load
+ *   control "name"                       - starting control used by the next load
+ *   watch "process"                      - process to kill with START + hotkey
+ *   mode keyboard|xbox                   - switch modes, reloads the configs
+ *   reload                               - reload the current config files
+ *   status                               - show the current settings
+ *   quit                                 - stop the daemon
+ *
+ * Each command is answered with a line starting with "ok" or "error:".
+ *
+ * gptokeyb2 -C <socket> <command> [args...] sends a command and prints the reply.
+ */
+
+#define DAEMON_CLIENTS_MAX 4
+#define DAEMON_LINE_MAX 2048
+
+typedef struct
+{
+    int fd;
+    size_t line_len;
+    char line[DAEMON_LINE_MAX];
+} daemon_client;
+
+bool daemon_mode = false;
+
+static int daemon_fd = -1;
+static char daemon_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static daemon_client daemon_clients[DAEMON_CLIENTS_MAX];
+
+
+static bool daemon_address(struct sockaddr_un *address, const char *socket_path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "daemon: socket path too long '%s'\n", socket_path);
+        return false;
+    }
+
+    strncpy(address->sun_path, socket_path, sizeof(address->sun_path) - 1);
+    return true;
+}
+
+
+static void daemon_reply(daemon_client *client, const char *fmt, ...)
+{
+    char buffer[DAEMON_LINE_MAX];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return;
+
+    if ((size_t)len > sizeof(buffer) - 2)
+        len = sizeof(buffer) - 2;
+
+    buffer[len++] = '\n';
+
+    // MSG_NOSIGNAL, a client going away shouldn't take the daemon with it.
+    if (send(client->fd, buffer, len, MSG_NOSIGNAL) < 0)
+        fprintf(stderr, "daemon: unable to reply: %s\n", strerror(errno));
+}
+
+
+static bool daemon_load(bool user_config)
+{   // throw away the current configs and load them again.
+    state_release_all();
+    input_stop();
+
+    gptokeyb_config_depth = 0;
+
+    config_quit();
+    input_quit();
+
+    state_config_defaults();
+
+    config_init();
+    input_init();
+
+    // the cache isn't used without the users config, it would be saved without it.
+    return (config_load_all(user_config, user_config) == 0);
+}
+
+
+static bool daemon_files_readable()
+{   // check the config files are there before throwing the current configs away.
+    for (int i=0; i < config_file_count; i++)
+    {
+        if (access(config_files[i].file_name, R_OK) != 0)
+        {
+            fprintf(stderr, "daemon: unable to read '%s': %s\n", config_files[i].file_name, strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool daemon_reload()
+{   /* Load the config files again, if the users config is broken they are
+     * loaded without it and this returns false.
+     */
+    bool loaded = daemon_load(true);
+
+    if (!loaded)
+    {
+        fprintf(stderr, "daemon: unable to load '%s', carrying on without it\n", user_config_file);
+        daemon_load(false);
+    }
+
+    config_select_default(default_control);
+
+    if (xbox360_mode)
+        config_overlay_clear(root_config);
+
+    keyboard_set_repeat();
+    state_change_update();
+
+    return loaded;
+}
+
+
+static bool daemon_set_mode(const char *mode)
+{
+    if (strcasecmp(mode, "xbox") == 0 || strcasecmp(mode, "xbox360") == 0)
+    {
+        if (xbox_uinp_fd == 0)
+            setupFakeXbox360Device();
+
+        xbox360_mode = true;
+        config_mode = false;
+    }
+    else if (strcasecmp(mode, "keyboard") == 0)
+    {
+        if (abs_uinp_fd == 0)
+            setupFakeAbsoluteMouseDevice();
+
+        xbox360_mode = false;
+        config_mode = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool daemon_reload_reply(daemon_client *client)
+{   // reload, replying with an error if that didn't work.
+    if (!daemon_files_readable())
+    {
+        daemon_reply(client, "error: unable to read the config files, kept the current configs");
+        return false;
+    }
+
+    if (!daemon_reload())
+    {
+        daemon_reply(client, "error: unable to load '%s', loaded the config files without it", user_config_file);
+        return false;
+    }
+
+    return true;
+}
+
+
+static void daemon_command(daemon_client *client, const char *line)
+{
+    char *temp_buffer = tabulate_text(line);
+
+    if (temp_buffer == NULL)
+        return;
+
+    token_ctx *token_state = tokens_create(temp_buffer, '\t');
+    free(temp_buffer);
+
+    // tokens are only valid until the next tokens_next, so keep a copy of the command.
+    char command[32] = "";
+    const char *token = tokens_next(token_state);
+
+    if (token != NULL)
+        strncpy(command, token, sizeof(command) - 1);
+
+    const char *value = tokens_next(token_state);
+
+    if (strlen(command) == 0)
+    {
+        // blank line
+    }
+    else if (strcasecmp(command, "load") == 0)
+    {
+        if (value == NULL)
+        {
+            daemon_reply(client, "error: load needs at least one config file");
+        }
+        else
+        {
+            static config_file saved_files[CONFIG_FILES_MAX];
+            int saved_count = config_file_count;
+
+            memcpy(saved_files, config_files, sizeof(config_file) * saved_count);
+            config_file_count = 0;
+
+            while (value != NULL)
+            {
+                if (strlen(value) > 0)
+                    config_add_file(value);
+
+                value = tokens_next(token_state);
+            }
+
+            Uint32 start_ticks = SDL_GetTicks();
+
+            if (!daemon_files_readable())
+            {   // go back to the files the current configs came from.
+                memcpy(config_files, saved_files, sizeof(config_file) * saved_count);
+                config_file_count = saved_count;
+
+                daemon_reply(client, "error: unable to read the config files, kept the current configs");
+            }
+            else if (daemon_reload_reply(client))
+            {
+                daemon_reply(client, "ok loaded %d files in %" PRIu32 "ms", config_file_count, SDL_GetTicks() - start_ticks);
+            }
+        }
+    }
+    else if (strcasecmp(command, "prefix") == 0)
+    {
+        strncpy(game_prefix, (value != NULL ? value : ""), MAX_PROCESS_NAME - 1);
+
+        for (int i=0; i < config_file_count; i++)
+            strncpy(config_files[i].game_prefix, game_prefix, MAX_PROCESS_NAME - 1);
+
+        daemon_reply(client, "ok prefix '%s'", game_prefix);
+    }
+    else if (strcasecmp(command, "control") == 0)
+    {
+        strncpy(default_control, (value != NULL ? value : ""), MAX_CONTROL_NAME - 1);
+        daemon_reply(client, "ok control '%s'", default_control);
+    }
+    else if (strcasecmp(command, "watch") == 0)
+    {
+        strncpy(kill_process_name, (value != NULL ? value : ""), MAX_PROCESS_NAME - 1);
+        daemon_reply(client, "ok watching '%s'", kill_process_name);
+    }
+    else if (strcasecmp(command, "mode") == 0)
+    {
+        if (value == NULL || !daemon_set_mode(value))
+        {
+            daemon_reply(client, "error: mode must be keyboard or xbox");
+        }
+        else if (daemon_reload_reply(client))
+        {
+            daemon_reply(client, "ok mode %s", (xbox360_mode ? "xbox" : "keyboard"));
+        }
+    }
+    else if (strcasecmp(command, "reload") == 0)
+    {
+        Uint32 start_ticks = SDL_GetTicks();
+
+        if (daemon_reload_reply(client))
+            daemon_reply(client, "ok reloaded in %" PRIu32 "ms", SDL_GetTicks() - start_ticks);
+    }
+    else if (strcasecmp(command, "status") == 0)
+    {
+        daemon_reply(client, "mode = %s", (xbox360_mode ? "xbox" : "keyboard"));
+        daemon_reply(client, "prefix = '%s'", game_prefix);
+        daemon_reply(client, "control = '%s'", config_stack[gptokeyb_config_depth]->name);
+        daemon_reply(client, "watch = '%s'", kill_process_name);
+
+        for (int i=0; i < config_file_count; i++)
+            daemon_reply(client, "file = '%s'", config_files[i].file_name);
+
+        daemon_reply(client, "ok");
+    }
+    else if (strcasecmp(command, "quit") == 0)
+    {
+        current_state.running = false;
+        daemon_reply(client, "ok");
+    }
+    else
+    {
+        daemon_reply(client, "error: unknown command '%s'", command);
+    }
+
+    tokens_free(token_state);
+}
+
+
+static void daemon_close_client(daemon_client *client)
+{
+    event_unwatch_fd(client->fd);
+    close(client->fd);
+
+    client->fd = -1;
+    client->line_len = 0;
+}
+
+
+static void daemon_client_ready(int fd, void *data)
+{
+    daemon_client *client = (daemon_client *)data;
+    char buffer[512];
+
+    ssize_t len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (len <= 0)
+    {   // EOF, run anything left without a newline.
+        if (client->line_len > 0)
+        {
+            client->line[client->line_len] = '\0';
+            daemon_command(client, client->line);
+        }
+
+        daemon_close_client(client);
+        return;
+    }
+
+    for (ssize_t i=0; i < len; i++)
+    {
+        if (buffer[i] == '\n' || buffer[i] == '\r')
+        {
+            client->line[client->line_len] = '\0';
+            client->line_len = 0;
+
+            daemon_command(client, client->line);
+        }
+        else if (client->line_len < (DAEMON_LINE_MAX - 1))
+        {
+            client->line[client->line_len++] = buffer[i];
+        }
+    }
+}
+
+
+static void daemon_accept(int fd, void *data)
+{
+    (void)data;
+
+    int client_fd = accept(fd, NULL, NULL);
+
+    if (client_fd < 0)
+        return;
+
+    fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+    for (int i=0; i < DAEMON_CLIENTS_MAX; i++)
+    {
+        daemon_client *client = &daemon_clients[i];
+
+        if (client->fd >= 0)
+            continue;
+
+        client->fd = client_fd;
+        client->line_len = 0;
+
+        if (!event_watch_fd(client_fd, daemon_client_ready, client))
+        {
+            close(client_fd);
+            client->fd = -1;
+        }
+
+        return;
+    }
+
+    fprintf(stderr, "daemon: too many clients\n");
+    close(client_fd);
+}
+
+
+bool daemon_init(const char *socket_path)
+{   // create the control socket.
+    struct sockaddr_un address;
+
+    for (int i=0; i < DAEMON_CLIENTS_MAX; i++)
+        daemon_clients[i].fd = -1;
+
+    if (!daemon_address(&address, socket_path))
+        return false;
+
+    daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (daemon_fd < 0)
+    {
+        fprintf(stderr, "daemon: unable to create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    fcntl(daemon_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(daemon_fd, F_SETFL, fcntl(daemon_fd, F_GETFL) | O_NONBLOCK);
+
+    // only our user can connect, the socket is created 0600.
+    mode_t old_umask = umask(0077);
+
+    int result = bind(daemon_fd, (struct sockaddr *)&address, sizeof(address));
+
+    if (result < 0 && errno == EADDRINUSE)
+    {   // is it left over from a daemon that died?
+        int test_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool stale = (test_fd >= 0 && connect(test_fd, (struct sockaddr *)&address, sizeof(address)) < 0 && errno == ECONNREFUSED);
+
+        if (test_fd >= 0)
+            close(test_fd);
+
+        if (stale)
+        {
+            unlink(socket_path);
+            result = bind(daemon_fd, (struct sockaddr *)&address, sizeof(address));
+        }
+        else
+        {
+            errno = EADDRINUSE;
+        }
+    }
+
+    umask(old_umask);
+
+    if (result < 0 || listen(daemon_fd, DAEMON_CLIENTS_MAX) < 0)
+    {
+        fprintf(stderr, "daemon: unable to listen on '%s': %s\n", socket_path, strerror(errno));
+        close(daemon_fd);
+        daemon_fd = -1;
+        return false;
+    }
+
+    strncpy(daemon_socket_path, socket_path, sizeof(daemon_socket_path) - 1);
+
+    if (!event_watch_fd(daemon_fd, daemon_accept, NULL))
+    {
+        daemon_quit();
+        return false;
+    }
+
+    printf("Listening on '%s'\n", socket_path);
+    return true;
+}
+
+
+void daemon_quit()
+{
+    for (int i=0; i < DAEMON_CLIENTS_MAX; i++)
+    {
+        if (daemon_clients[i].fd >= 0)
+            daemon_close_client(&daemon_clients[i]);
+    }
+
+    if (daemon_fd >= 0)
+    {
+        event_unwatch_fd(daemon_fd);
+        close(daemon_fd);
+        unlink(daemon_socket_path);
+    }
+
+    daemon_fd = -1;
+}
+
+
+void daemon_target_quit()
+{   // the watched process was killed, carry on without it.
+    printf("Stopped watching '%s'\n", kill_process_name);
+
+    kill_process_name[0] = '\0';
+    state_release_all();
+}
+
+
+int daemon_client_main(const char *socket_path, int argc, char *argv[])
+{   // send a command to a running daemon and print the reply.
+    struct sockaddr_un address;
+    char buffer[DAEMON_LINE_MAX];
+    size_t len = 0;
+
+    if (argc < 1)
+    {
+        fprintf(stderr, "daemon: no command given\n");
+        return 1;
+    }
+
+    if (!daemon_address(&address, socket_path))
+        return 1;
+
+    for (int i=0; i < argc; i++)
+    {   // quote everything so paths with spaces survive.
+        int written = snprintf(buffer + len, sizeof(buffer) - len, "%s\"%s\"", (i > 0 ? " " : ""), argv[i]);
+
+        if (written < 0 || (size_t)written >= sizeof(buffer) - len - 1)
+        {
+            fprintf(stderr, "daemon: command too long\n");
+            return 1;
+        }
+
+        len += written;
+    }
+
+    buffer[len++] = '\n';
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        fprintf(stderr, "daemon: unable to connect to '%s': %s\n", socket_path, strerror(errno));
+
+        if (fd >= 0)
+            close(fd);
+
+        return 1;
+    }
+
+    if (send(fd, buffer, len, MSG_NOSIGNAL) < 0)
+    {
+        fprintf(stderr, "daemon: unable to send command: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    // read the whole reply before looking for errors, status can be long.
+    size_t reply_size = DAEMON_LINE_MAX;
+    char *reply = (char *)gptk_malloc(reply_size);
+    ssize_t read_len;
+    len = 0;
+
+    while ((read_len = recv(fd, reply + len, reply_size - len - 1, 0)) > 0)
+    {
+        len += read_len;
+
+        if (len >= reply_size - 1)
+        {
+            reply = (char *)gptk_realloc(reply, reply_size, reply_size * 2);
+            reply_size *= 2;
+        }
+    }
+
+    close(fd);
+
+    reply[len] = '\0';
+    fwrite(reply, 1, len, stdout);
+
+    bool failed = (strncmp(reply, "error:", 6) == 0 || strstr(reply, "\nerror:") != NULL);
+    free(reply);
+
+    return (failed ? 1 : 0);
+}
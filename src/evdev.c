@@ -0,0 +1,738 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+/* Native evdev input backend.
+ *
+ * SDL is only used to find the controllers and translate the gamecontrollerdb
+ * mapping into evdev codes once, after that we read the /dev/input/event* nodes
+ * directly with libevdev under epoll and feed the results through
+ * handleInputEvent() as if SDL had sent them.
+ *
+ * Hotplugging is handled by watching /dev/input with inotify, when something
+ * shows up we let SDL have a look for a little while so it can send us a
+ * SDL_CONTROLLERDEVICEADDED event.
+ */
+
+#define EVDEV_MAX_EVENTS 16
+#define EVDEV_MAX_HATS 4
+
+// how long to keep asking SDL about new devices after /dev/input changes
+#define EVDEV_HOTPLUG_TIME 2000
+#define EVDEV_HOTPLUG_POLL 100
+
+// axis values past this count as a button press
+#define EVDEV_AXIS_BUTTON_THRESHOLD 16384
+
+typedef struct
+{
+    Sint8 button;     // SDL_GameControllerButton or -1
+    Sint8 button_neg; // button on the negative half of an axis or -1
+    Sint8 axis;       // SDL_GameControllerAxis or -1
+} evdev_target;
+
+typedef struct _evdev_controller
+{
+    struct _evdev_controller *next;
+    struct libevdev *dev;
+    int fd;
+    Sint32 which;
+
+    evdev_target key_target[KEY_CNT];
+    evdev_target abs_target[ABS_CNT];
+    Sint8 hat_target[EVDEV_MAX_HATS][4]; // up, right, down, left
+    Sint8 hat_index[EVDEV_MAX_HATS];     // ABS_HAT0X.. pair -> SDL hat, or -1
+
+    int hat_x[EVDEV_MAX_HATS];
+    int hat_y[EVDEV_MAX_HATS];
+
+    bool button_state[SDL_CONTROLLER_BUTTON_MAX];
+    Sint16 axis_state[SDL_CONTROLLER_AXIS_MAX];
+} evdev_controller;
+
+bool evdev_mode = false;
+
+static int evdev_epoll_fd = -1;
+static int evdev_inotify_fd = -1;
+static Uint32 evdev_hotplug_until = 0;
+static bool evdev_hotplug_active = false;
+static evdev_controller *evdev_controllers = NULL;
+
+// marker for the inotify fd in the epoll set
+static int evdev_inotify_marker;
+
+
+void evdev_init()
+{
+    evdev_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (evdev_epoll_fd < 0)
+    {
+        fprintf(stderr, "evdev: unable to create epoll: %s\n", strerror(errno));
+        exit(255);
+    }
+
+    evdev_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (evdev_inotify_fd >= 0)
+    {
+        struct epoll_event ev;
+
+        if (inotify_add_watch(evdev_inotify_fd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0)
+        {
+            fprintf(stderr, "evdev: unable to watch /dev/input, hotplug disabled: %s\n", strerror(errno));
+            close(evdev_inotify_fd);
+            evdev_inotify_fd = -1;
+        }
+        else
+        {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = &evdev_inotify_marker;
+            epoll_ctl(evdev_epoll_fd, EPOLL_CTL_ADD, evdev_inotify_fd, &ev);
+        }
+    }
+
+    evdev_controllers = NULL;
+    evdev_hotplug_active = false;
+}
+
+
+static void evdev_free_controller(evdev_controller *controller)
+{
+    epoll_ctl(evdev_epoll_fd, EPOLL_CTL_DEL, controller->fd, NULL);
+    controller_remove_fd(controller->which);
+
+    libevdev_free(controller->dev);
+    close(controller->fd);
+    free(controller);
+}
+
+
+void evdev_quit()
+{
+    evdev_controller *current = evdev_controllers;
+    evdev_controller *next;
+
+    while (current != NULL)
+    {
+        next = current->next;
+        evdev_free_controller(current);
+        current = next;
+    }
+
+    evdev_controllers = NULL;
+
+    if (evdev_inotify_fd >= 0)
+        close(evdev_inotify_fd);
+
+    if (evdev_epoll_fd >= 0)
+        close(evdev_epoll_fd);
+
+    evdev_inotify_fd = -1;
+    evdev_epoll_fd = -1;
+}
+
+
+static void evdev_remove_controller(evdev_controller *controller)
+{
+    evdev_controller *current = evdev_controllers;
+    evdev_controller *prev = NULL;
+
+    while (current != NULL)
+    {
+        if (current == controller)
+        {
+            if (prev != NULL)
+                prev->next = current->next;
+            else
+                evdev_controllers = current->next;
+
+            printf("evdev: controller %d removed\n", controller->which);
+            evdev_free_controller(controller);
+            return;
+        }
+
+        prev = current;
+        current = current->next;
+    }
+}
+
+
+static int evdev_half_axis(const char *mapping, SDL_GameControllerButton button)
+{   /* The bind doesn't say which half of an axis a button is on, so look for
+     * "dpup:-a1" or "dpdown:+a1" in the mapping. Returns -1 for the negative
+     * half and 1 for the positive half or a whole axis.
+     */
+    const char *name = SDL_GameControllerGetStringForButton(button);
+    const char *field = mapping;
+
+    if (name == NULL || mapping == NULL)
+        return 1;
+
+    size_t name_len = strlen(name);
+
+    while (field != NULL)
+    {
+        if (strncmp(field, name, name_len) == 0 && field[name_len] == ':')
+        {
+            const char *value = field + name_len + 1;
+            size_t value_len = strcspn(value, ",");
+            int half = (value[0] == '-' ? -1 : 1);
+
+            // "a1~" is an inverted axis
+            if (value_len > 0 && value[value_len - 1] == '~')
+                half = -half;
+
+            return half;
+        }
+
+        field = strchr(field, ',');
+
+        if (field != NULL)
+            field++;
+    }
+
+    return 1;
+}
+
+
+static void evdev_map_controller(evdev_controller *controller, SDL_GameController *sdl_controller)
+{   /* Work out the evdev code for each SDL joystick button/axis/hat, this
+     * follows the same order SDL uses to number them on linux, then bind
+     * the game controller mapping onto them.
+     */
+    int button_codes[KEY_CNT];
+    int axis_codes[ABS_CNT];
+    int button_count = 0;
+    int axis_count = 0;
+    int hat_count = 0;
+    char *mapping = SDL_GameControllerMapping(sdl_controller);
+
+    for (int code=0; code < KEY_CNT; code++)
+    {
+        controller->key_target[code].button = -1;
+        controller->key_target[code].button_neg = -1;
+        controller->key_target[code].axis = -1;
+    }
+
+    for (int code=0; code < ABS_CNT; code++)
+    {
+        controller->abs_target[code].button = -1;
+        controller->abs_target[code].button_neg = -1;
+        controller->abs_target[code].axis = -1;
+    }
+
+    for (int hat=0; hat < EVDEV_MAX_HATS; hat++)
+    {
+        controller->hat_index[hat] = -1;
+
+        for (int i=0; i < 4; i++)
+            controller->hat_target[hat][i] = -1;
+    }
+
+    for (int code=BTN_JOYSTICK; code < KEY_MAX; code++)
+    {
+        if (libevdev_has_event_code(controller->dev, EV_KEY, code))
+            button_codes[button_count++] = code;
+    }
+
+    for (int code=0; code < BTN_JOYSTICK; code++)
+    {
+        if (libevdev_has_event_code(controller->dev, EV_KEY, code))
+            button_codes[button_count++] = code;
+    }
+
+    for (int code=0; code < ABS_MAX; code++)
+    {
+        if (code == ABS_HAT0X)
+        {   // hats are numbered separately
+            code = ABS_HAT3Y;
+            continue;
+        }
+
+        if (libevdev_has_event_code(controller->dev, EV_ABS, code))
+            axis_codes[axis_count++] = code;
+    }
+
+    for (int code=ABS_HAT0X; code <= ABS_HAT3Y; code += 2)
+    {   // SDL skips missing hats, so HAT1 alone is SDL hat 0
+        if (libevdev_has_event_code(controller->dev, EV_ABS, code) ||
+            libevdev_has_event_code(controller->dev, EV_ABS, code + 1))
+        {
+            controller->hat_index[(code - ABS_HAT0X) / 2] = hat_count++;
+        }
+    }
+
+    for (int button=0; button < SDL_CONTROLLER_BUTTON_MAX; button++)
+    {
+        SDL_GameControllerButtonBind bind = SDL_GameControllerGetBindForButton(sdl_controller, (SDL_GameControllerButton)button);
+
+        if (bind.bindType == SDL_CONTROLLER_BINDTYPE_BUTTON &&
+            bind.value.button >= 0 && bind.value.button < button_count)
+        {
+            controller->key_target[button_codes[bind.value.button]].button = button;
+        }
+        else if (bind.bindType == SDL_CONTROLLER_BINDTYPE_AXIS &&
+            bind.value.axis >= 0 && bind.value.axis < axis_count)
+        {
+            evdev_target *target = &controller->abs_target[axis_codes[bind.value.axis]];
+
+            if (evdev_half_axis(mapping, (SDL_GameControllerButton)button) < 0)
+                target->button_neg = button;
+            else
+                target->button = button;
+        }
+        else if (bind.bindType == SDL_CONTROLLER_BINDTYPE_HAT &&
+            bind.value.hat.hat >= 0 && bind.value.hat.hat < hat_count)
+        {
+            for (int i=0; i < 4; i++)
+            {   // SDL_HAT_UP, SDL_HAT_RIGHT, SDL_HAT_DOWN, SDL_HAT_LEFT
+                if (bind.value.hat.hat_mask & (1<<i))
+                    controller->hat_target[bind.value.hat.hat][i] = button;
+            }
+        }
+    }
+
+    for (int axis=0; axis < SDL_CONTROLLER_AXIS_MAX; axis++)
+    {
+        SDL_GameControllerButtonBind bind = SDL_GameControllerGetBindForAxis(sdl_controller, (SDL_GameControllerAxis)axis);
+
+        if (bind.bindType == SDL_CONTROLLER_BINDTYPE_AXIS &&
+            bind.value.axis >= 0 && bind.value.axis < axis_count)
+        {
+            controller->abs_target[axis_codes[bind.value.axis]].axis = axis;
+        }
+        else if (bind.bindType == SDL_CONTROLLER_BINDTYPE_BUTTON &&
+            bind.value.button >= 0 && bind.value.button < button_count)
+        {
+            controller->key_target[button_codes[bind.value.button]].axis = axis;
+        }
+    }
+
+    if (mapping != NULL)
+        SDL_free(mapping);
+}
+
+
+static void evdev_sync_abs(evdev_controller *controller);
+
+
+void evdev_add_controller(SDL_GameController *sdl_controller, int sdl_fd)
+{   /* Open our own fd for the device SDL just opened, SDL can close its
+     * controller after this.
+     */
+    char fd_path[64];
+    char dev_path[MAX_PATH];
+    ssize_t dev_path_len;
+
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", sdl_fd);
+    dev_path_len = readlink(fd_path, dev_path, sizeof(dev_path) - 1);
+
+    if (dev_path_len <= 0)
+    {
+        fprintf(stderr, "evdev: unable to find device for fd %d: %s\n", sdl_fd, strerror(errno));
+        return;
+    }
+
+    dev_path[dev_path_len] = '\0';
+
+    evdev_controller *controller = (evdev_controller*)gptk_malloc(sizeof(evdev_controller));
+    memset(controller, 0, sizeof(evdev_controller));
+
+    controller->fd = open(dev_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (controller->fd < 0)
+    {
+        fprintf(stderr, "evdev: unable to open %s: %s\n", dev_path, strerror(errno));
+        free(controller);
+        return;
+    }
+
+    int rc = libevdev_new_from_fd(controller->fd, &controller->dev);
+
+    if (rc < 0)
+    {
+        fprintf(stderr, "evdev: unable to init %s: %s\n", dev_path, strerror(-rc));
+        close(controller->fd);
+        free(controller);
+        return;
+    }
+
+    if (trace_enabled)
+    {   // so the event timestamps can be compared with CLOCK_MONOTONIC.
+        libevdev_set_clock_id(controller->dev, CLOCK_MONOTONIC);
+    }
+
+    controller->which = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(sdl_controller));
+
+    evdev_map_controller(controller, sdl_controller);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = controller;
+
+    if (epoll_ctl(evdev_epoll_fd, EPOLL_CTL_ADD, controller->fd, &ev) < 0)
+    {
+        fprintf(stderr, "evdev: unable to watch %s: %s\n", dev_path, strerror(errno));
+        libevdev_free(controller->dev);
+        close(controller->fd);
+        free(controller);
+        return;
+    }
+
+    controller_add_fd(controller->which, controller->fd);
+
+    controller->next = evdev_controllers;
+    evdev_controllers = controller;
+
+    printf("evdev: reading '%s' from %s\n", libevdev_get_name(controller->dev), dev_path);
+
+    evdev_sync_abs(controller);
+}
+
+
+static void evdev_button(evdev_controller *controller, int button, bool pressed)
+{
+    SDL_Event event;
+
+    if (controller->button_state[button] == pressed)
+        return;
+
+    controller->button_state[button] = pressed;
+
+    memset(&event, 0, sizeof(event));
+    event.type = (pressed ? SDL_CONTROLLERBUTTONDOWN : SDL_CONTROLLERBUTTONUP);
+    event.cbutton.timestamp = SDL_GetTicks();
+    event.cbutton.which = controller->which;
+    event.cbutton.button = button;
+    event.cbutton.state = (pressed ? 1 : 0);
+
+    handleInputEvent(&event);
+}
+
+
+static void evdev_axis(evdev_controller *controller, int axis, int value)
+{
+    SDL_Event event;
+
+    if (axis == SDL_CONTROLLER_AXIS_TRIGGERLEFT || axis == SDL_CONTROLLER_AXIS_TRIGGERRIGHT)
+    {   // triggers go from 0 to 32767
+        value = (value + 32768) >> 1;
+    }
+
+    if (controller->axis_state[axis] == value)
+        return;
+
+    controller->axis_state[axis] = value;
+
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_CONTROLLERAXISMOTION;
+    event.caxis.timestamp = SDL_GetTicks();
+    event.caxis.which = controller->which;
+    event.caxis.axis = axis;
+    event.caxis.value = value;
+
+    handleInputEvent(&event);
+}
+
+
+static int evdev_scale_axis(evdev_controller *controller, int code, int value)
+{   // scale to -32768 .. 32767 like SDL does.
+    const struct input_absinfo *info = libevdev_get_abs_info(controller->dev, code);
+
+    if (info == NULL || info->maximum <= info->minimum)
+        return value;
+
+    Sint64 scaled = ((Sint64)(value - info->minimum) * 65535) / (info->maximum - info->minimum) - 32768;
+
+    if (scaled < -32768)
+        scaled = -32768;
+
+    else if (scaled > 32767)
+        scaled = 32767;
+
+    return (int)scaled;
+}
+
+
+static void evdev_hat(evdev_controller *controller, int hat)
+{
+    // SDL_HAT_UP, SDL_HAT_RIGHT, SDL_HAT_DOWN, SDL_HAT_LEFT
+    bool direction[4] = {
+        controller->hat_y[hat] < 0,
+        controller->hat_x[hat] > 0,
+        controller->hat_y[hat] > 0,
+        controller->hat_x[hat] < 0,
+    };
+
+    for (int i=0; i < 4; i++)
+    {
+        if (controller->hat_target[hat][i] >= 0)
+            evdev_button(controller, controller->hat_target[hat][i], direction[i]);
+    }
+}
+
+
+static void evdev_abs(evdev_controller *controller, int code, int raw_value)
+{
+    if (code >= ABS_HAT0X && code <= ABS_HAT3Y)
+    {
+        int hat = controller->hat_index[(code - ABS_HAT0X) / 2];
+
+        if (hat < 0)
+            return;
+
+        if (((code - ABS_HAT0X) & 1) == 0)
+            controller->hat_x[hat] = raw_value;
+        else
+            controller->hat_y[hat] = raw_value;
+
+        evdev_hat(controller, hat);
+        return;
+    }
+
+    if (code >= ABS_CNT)
+        return;
+
+    const evdev_target *target = &controller->abs_target[code];
+    int value;
+
+    if (target->button < 0 && target->button_neg < 0 && target->axis < 0)
+        return;
+
+    value = evdev_scale_axis(controller, code, raw_value);
+
+    if (target->button >= 0)
+        evdev_button(controller, target->button, value > EVDEV_AXIS_BUTTON_THRESHOLD);
+
+    if (target->button_neg >= 0)
+        evdev_button(controller, target->button_neg, value < -EVDEV_AXIS_BUTTON_THRESHOLD);
+
+    if (target->axis >= 0)
+        evdev_axis(controller, target->axis, value);
+}
+
+
+static void evdev_sync_abs(evdev_controller *controller)
+{   /* Pick up where the axes already are, otherwise a stick held when the
+     * controller shows up isn't seen until it moves.
+     */
+    for (int code=0; code < ABS_CNT; code++)
+    {
+        if (libevdev_has_event_code(controller->dev, EV_ABS, code))
+            evdev_abs(controller, code, libevdev_get_event_value(controller->dev, EV_ABS, code));
+    }
+}
+
+
+static void evdev_handle_event(evdev_controller *controller, const struct input_event *ev)
+{
+    if (trace_enabled)
+        trace_source(&ev->time);
+
+    if (ev->type == EV_KEY)
+    {
+        const evdev_target *target;
+
+        if (ev->code >= KEY_CNT || ev->value == 2)
+            return;
+
+        target = &controller->key_target[ev->code];
+
+        if (target->button >= 0)
+            evdev_button(controller, target->button, ev->value != 0);
+
+        if (target->axis >= 0)
+            evdev_axis(controller, target->axis, (ev->value != 0) ? 32767 : -32768);
+    }
+    else if (ev->type == EV_ABS)
+    {
+        evdev_abs(controller, ev->code, ev->value);
+    }
+}
+
+
+static bool evdev_read(evdev_controller *controller)
+{   // returns false if the controller has gone away.
+    struct input_event ev;
+    unsigned int flags = LIBEVDEV_READ_FLAG_NORMAL;
+    int rc;
+
+    while (current_state.running)
+    {
+        rc = libevdev_next_event(controller->dev, flags, &ev);
+
+        if (rc == LIBEVDEV_READ_STATUS_SYNC)
+        {   // we dropped events, catch up on the current device state.
+            flags = LIBEVDEV_READ_FLAG_SYNC;
+            evdev_handle_event(controller, &ev);
+            continue;
+        }
+
+        if (rc == LIBEVDEV_READ_STATUS_SUCCESS)
+        {
+            evdev_handle_event(controller, &ev);
+            continue;
+        }
+
+        if (rc == -EAGAIN && flags == LIBEVDEV_READ_FLAG_SYNC)
+        {   // finished syncing
+            flags = LIBEVDEV_READ_FLAG_NORMAL;
+            continue;
+        }
+
+        if (rc == -EAGAIN || rc == -EINTR)
+            return true;
+
+        return false;
+    }
+
+    return true;
+}
+
+
+bool evdev_watch_fd(int fd, void *ptr)
+{   // add a non controller fd to the epoll set, see event_watch_fd.
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+
+    if (epoll_ctl(evdev_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        fprintf(stderr, "evdev: unable to watch fd %d: %s\n", fd, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+void evdev_unwatch_fd(int fd)
+{
+    if (evdev_epoll_fd >= 0)
+        epoll_ctl(evdev_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+static void evdev_pump_sdl()
+{   // let SDL look for new controllers, and pass on any SDL_QUIT
+    SDL_Event event;
+
+    while (current_state.running && SDL_PollEvent(&event))
+    {
+        handleInputEvent(&event);
+    }
+}
+
+
+static int evdev_epoll_wait(struct epoll_event *events, Sint64 timeout)
+{   /* epoll_wait only takes whole ms, so a 1.5ms mouse_rate tick would wait
+     * 2ms. epoll_pwait2 takes a timespec, kernels before 5.11 don't have it.
+     */
+#ifdef SYS_epoll_pwait2
+    static bool no_pwait2 = false;
+
+    if (!no_pwait2)
+    {
+        struct timespec wait_time;
+
+        wait_time.tv_sec  = (timeout < 0 ? 0 : timeout / (Sint64)NS_PER_SEC);
+        wait_time.tv_nsec = (timeout < 0 ? 0 : timeout % (Sint64)NS_PER_SEC);
+
+        int count = syscall(SYS_epoll_pwait2, evdev_epoll_fd, events, EVDEV_MAX_EVENTS,
+            (timeout < 0 ? NULL : &wait_time), NULL, 0);
+
+        if (count >= 0 || errno != ENOSYS)
+            return count;
+
+        no_pwait2 = true;
+    }
+#endif
+
+    return epoll_wait(evdev_epoll_fd, events, EVDEV_MAX_EVENTS, clock_timeout_ms(timeout));
+}
+
+
+bool evdev_wait(Sint64 timeout)
+{   /* Wait up to timeout ns (-1 is forever) for input, and handle it. */
+    struct epoll_event events[EVDEV_MAX_EVENTS];
+    char inotify_buffer[1024];
+
+    if (evdev_hotplug_active)
+    {
+        if (SDL_TICKS_PASSED(SDL_GetTicks(), evdev_hotplug_until))
+        {
+            evdev_hotplug_active = false;
+        }
+        else
+        {
+            evdev_pump_sdl();
+
+            if (timeout < 0 || timeout > (Sint64)MS_TO_NS(EVDEV_HOTPLUG_POLL))
+                timeout = MS_TO_NS(EVDEV_HOTPLUG_POLL);
+        }
+    }
+
+    int count = evdev_epoll_wait(events, timeout);
+
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {   // probably SIGINT/SIGTERM, SDL turns these into SDL_QUIT
+            evdev_pump_sdl();
+            return true;
+        }
+
+        fprintf(stderr, "evdev: epoll_wait() failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    for (int i=0; i < count; i++)
+    {
+        if (events[i].data.ptr == &evdev_inotify_marker)
+        {
+            while (read(evdev_inotify_fd, inotify_buffer, sizeof(inotify_buffer)) > 0)
+                ;
+
+            evdev_hotplug_active = true;
+            evdev_hotplug_until = SDL_GetTicks() + EVDEV_HOTPLUG_TIME;
+            evdev_pump_sdl();
+            continue;
+        }
+
+        if (event_watch_ready(events[i].data.ptr))
+            continue;
+
+        evdev_controller *controller = (evdev_controller*)events[i].data.ptr;
+
+        if (!evdev_read(controller))
+            evdev_remove_controller(controller);
+    }
+
+    return true;
+}
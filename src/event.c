@@ -36,6 +36,316 @@
 */
 
 #include "gptokeyb2.h"
+#include <poll.h>
+
+/* File descriptor watches.
+ *
+ * Things like the daemon control socket need to wake up the main loop. In
+ * evdev mode the fds go straight into the epoll set. In SDL mode we can only
+ * wait on the SDL event queue, so a helper thread polls the fds and pushes a
+ * SDL_USEREVENT when one is ready. The fd is then left alone until the main
+ * thread has run the callback.
+ */
+
+#define EVENT_WATCH_MAX 16
+
+typedef struct _event_watch
+{
+    struct _event_watch *next;
+    int fd;
+    event_watch_func func;
+    void *data;
+    bool pending;
+} event_watch;
+
+static event_watch *event_watches = NULL;
+
+static Uint32 event_watch_type = (Uint32)-1;
+static SDL_Thread *event_watch_thread = NULL;
+static SDL_mutex *event_watch_mutex = NULL;
+static int event_watch_wake[2] = {-1, -1};
+static bool event_watch_running = false;
+
+
+static void event_watch_poke()
+{   // wake the helper thread so it picks up changes.
+    char byte = 0;
+
+    if (event_watch_wake[1] >= 0)
+    {
+        if (write(event_watch_wake[1], &byte, 1) < 0 && errno != EAGAIN)
+            fprintf(stderr, "event: unable to wake watch thread: %s\n", strerror(errno));
+    }
+}
+
+
+static event_watch *event_watch_find(const void *ptr)
+{
+    for (event_watch *watch = event_watches; watch != NULL; watch = watch->next)
+    {
+        if (watch == ptr)
+            return watch;
+    }
+
+    return NULL;
+}
+
+
+static int event_watch_thread_main(void *data)
+{
+    struct pollfd fds[EVENT_WATCH_MAX + 1];
+    event_watch *watches[EVENT_WATCH_MAX + 1];
+    char buffer[64];
+
+    (void)data;
+
+    while (true)
+    {
+        int count = 0;
+
+        fds[count].fd = event_watch_wake[0];
+        fds[count].events = POLLIN;
+        watches[count++] = NULL;
+
+        SDL_LockMutex(event_watch_mutex);
+
+        if (!event_watch_running)
+        {
+            SDL_UnlockMutex(event_watch_mutex);
+            break;
+        }
+
+        for (event_watch *watch = event_watches; watch != NULL && count <= EVENT_WATCH_MAX; watch = watch->next)
+        {
+            if (watch->pending)
+                continue;
+
+            fds[count].fd = watch->fd;
+            fds[count].events = POLLIN;
+            watches[count++] = watch;
+        }
+
+        SDL_UnlockMutex(event_watch_mutex);
+
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "event: poll() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents != 0)
+        {
+            while (read(event_watch_wake[0], buffer, sizeof(buffer)) > 0)
+                ;
+        }
+
+        SDL_LockMutex(event_watch_mutex);
+
+        for (int i=1; i < count; i++)
+        {
+            // it may have been removed while we were waiting.
+            if (fds[i].revents == 0 || event_watch_find(watches[i]) == NULL)
+                continue;
+
+            SDL_Event event;
+
+            memset(&event, 0, sizeof(event));
+            event.type = event_watch_type;
+            event.user.data1 = watches[i];
+
+            watches[i]->pending = true;
+            SDL_PushEvent(&event);
+        }
+
+        SDL_UnlockMutex(event_watch_mutex);
+    }
+
+    return 0;
+}
+
+
+static bool event_watch_start()
+{   // start the helper thread for SDL mode
+    if (event_watch_thread != NULL)
+        return true;
+
+    event_watch_type = SDL_RegisterEvents(1);
+
+    if (event_watch_type == (Uint32)-1)
+    {
+        fprintf(stderr, "event: unable to register watch event: %s\n", SDL_GetError());
+        return false;
+    }
+
+    if (pipe(event_watch_wake) < 0)
+    {
+        fprintf(stderr, "event: unable to create watch pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    for (int i=0; i < 2; i++)
+    {
+        fcntl(event_watch_wake[i], F_SETFL, fcntl(event_watch_wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(event_watch_wake[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    event_watch_mutex = SDL_CreateMutex();
+    event_watch_running = true;
+    event_watch_thread = SDL_CreateThread(event_watch_thread_main, "gptk2-watch", NULL);
+
+    if (event_watch_thread == NULL)
+    {
+        fprintf(stderr, "event: unable to create watch thread: %s\n", SDL_GetError());
+        event_watch_running = false;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool event_watch_fd(int fd, event_watch_func func, void *data)
+{   /* Call func from the main loop whenever fd is readable.
+     *
+     * The callback must read or remove the fd, otherwise it is called again straight away.
+     */
+    int count = 0;
+
+    for (event_watch *watch = event_watches; watch != NULL; watch = watch->next)
+        count++;
+
+    if (count >= EVENT_WATCH_MAX)
+    {
+        fprintf(stderr, "event: too many watched fds\n");
+        return false;
+    }
+
+    if (!evdev_mode && !event_watch_start())
+        return false;
+
+    event_watch *watch = (event_watch *)gptk_malloc(sizeof(event_watch));
+
+    watch->fd = fd;
+    watch->func = func;
+    watch->data = data;
+
+    if (evdev_mode && !evdev_watch_fd(fd, watch))
+    {
+        free(watch);
+        return false;
+    }
+
+    if (event_watch_mutex != NULL)
+        SDL_LockMutex(event_watch_mutex);
+
+    watch->next = event_watches;
+    event_watches = watch;
+
+    if (event_watch_mutex != NULL)
+        SDL_UnlockMutex(event_watch_mutex);
+
+    event_watch_poke();
+    return true;
+}
+
+
+void event_unwatch_fd(int fd)
+{
+    event_watch *prev = NULL;
+
+    if (event_watch_mutex != NULL)
+        SDL_LockMutex(event_watch_mutex);
+
+    for (event_watch *watch = event_watches; watch != NULL; prev = watch, watch = watch->next)
+    {
+        if (watch->fd != fd)
+            continue;
+
+        if (prev != NULL)
+            prev->next = watch->next;
+        else
+            event_watches = watch->next;
+
+        if (evdev_mode)
+            evdev_unwatch_fd(fd);
+
+        free(watch);
+        break;
+    }
+
+    if (event_watch_mutex != NULL)
+        SDL_UnlockMutex(event_watch_mutex);
+
+    event_watch_poke();
+}
+
+
+bool event_watch_ready(void *ptr)
+{   // run the callback for a watch, returns false if ptr is not a watch.
+    event_watch *watch = event_watch_find(ptr);
+
+    if (watch == NULL)
+        return false;
+
+    watch->func(watch->fd, watch->data);
+
+    // the callback may have removed it.
+    watch = event_watch_find(ptr);
+
+    if (watch != NULL && watch->pending)
+    {
+        SDL_LockMutex(event_watch_mutex);
+        watch->pending = false;
+        SDL_UnlockMutex(event_watch_mutex);
+
+        event_watch_poke();
+    }
+
+    return true;
+}
+
+
+void event_quit()
+{
+    if (event_watch_thread != NULL)
+    {
+        SDL_LockMutex(event_watch_mutex);
+        event_watch_running = false;
+        SDL_UnlockMutex(event_watch_mutex);
+
+        event_watch_poke();
+        SDL_WaitThread(event_watch_thread, NULL);
+        event_watch_thread = NULL;
+    }
+
+    while (event_watches != NULL)
+    {
+        event_watch *next = event_watches->next;
+
+        if (evdev_mode)
+            evdev_unwatch_fd(event_watches->fd);
+
+        free(event_watches);
+        event_watches = next;
+    }
+
+    if (event_watch_mutex != NULL)
+    {
+        SDL_DestroyMutex(event_watch_mutex);
+        event_watch_mutex = NULL;
+    }
+
+    for (int i=0; i < 2; i++)
+    {
+        if (event_watch_wake[i] >= 0)
+            close(event_watch_wake[i]);
+
+        event_watch_wake[i] = -1;
+    }
+}
 
 
 void handleInputEvent(const SDL_Event *event)
@@ -48,6 +358,14 @@ void handleInputEvent(const SDL_Event *event)
         {
             const bool pressed = event->type == SDL_CONTROLLERBUTTONDOWN;
 
+            GPTK2_STAT(events_button);
+
+            if (record_enabled)
+                record_event(event);
+
+            if (trace_enabled)
+                trace_ingress(event);
+
             if (xbox360_mode)
             {
                 handleEventBtnFakeXbox360Device(event, pressed);
@@ -58,6 +376,14 @@ void handleInputEvent(const SDL_Event *event)
         break;
 
     case SDL_CONTROLLERAXISMOTION:
+        GPTK2_STAT(events_axis);
+
+        if (record_enabled)
+            record_event(event);
+
+        if (trace_enabled)
+            trace_ingress(event);
+
         if (xbox360_mode)
         {
             handleEventAxisFakeXbox360Device(event);
@@ -69,6 +395,7 @@ void handleInputEvent(const SDL_Event *event)
         break;
 
     case SDL_CONTROLLERDEVICEADDED:
+        GPTK2_STAT(events_device);
         {
             SDL_GameController* controller = SDL_GameControllerOpen(event->cdevice.which);
             if (controller)
@@ -77,7 +404,14 @@ void handleInputEvent(const SDL_Event *event)
                 SDL_Joystick *joystick = SDL_GameControllerGetJoystick(controller);
                 const char *name = SDL_JoystickName(joystick);
                 printf("Joystick %i has game controller name '%s': %d\n", 0, name, controller_fd);
-                if (strcmp(name, XBOX_CONTROLLER_NAME) != 0)
+                if (evdev_mode)
+                {   // we read it ourselves, SDL only gives us the mapping.
+                    if (strcmp(name, XBOX_CONTROLLER_NAME) != 0)
+                        evdev_add_controller(controller, controller_fd);
+
+                    SDL_GameControllerClose(controller);
+                }
+                else if (strcmp(name, XBOX_CONTROLLER_NAME) != 0)
                 {
                     SDL_GameControllerOpen(event->cdevice.which);
                     controller_add_fd(event->cdevice.which, controller_fd);
@@ -91,6 +425,7 @@ void handleInputEvent(const SDL_Event *event)
         break;
 
     case SDL_CONTROLLERDEVICEREMOVED:
+        GPTK2_STAT(events_device);
         {
             SDL_GameController* controller = SDL_GameControllerFromInstanceID(event->cdevice.which);
             if (controller)
@@ -102,7 +437,143 @@ void handleInputEvent(const SDL_Event *event)
         break;
 
     case SDL_QUIT:
+        GPTK2_STAT(events_other);
         current_state.running = false;
         return;
+
+    default:
+        if (event->type == event_watch_type)
+        {
+            GPTK2_STAT(events_watch);
+            event_watch_ready(event->user.data1);
+        }
+        else
+        {
+            GPTK2_STAT(events_other);
+        }
+        break;
     }
+
+    if (trace_enabled)
+        trace_done();
+}
+
+
+// a late mouse tick moves at most this many intervals worth.
+#define EVENT_MOUSE_CATCH_UP 4
+
+static Uint64 event_next_mouse_tick = 0;
+static Uint64 event_last_mouse_tick = 0;
+static bool event_mouse_moving = false;
+
+
+void event_loop_init(Uint64 now)
+{
+    event_next_mouse_tick = now;
+    event_last_mouse_tick = now;
+    event_mouse_moving = false;
+}
+
+
+static void event_timeout_min(Sint64 *timeout, Sint64 other)
+{   // -1 means no timeout.
+    if (other >= 0 && (*timeout < 0 || other < *timeout))
+        *timeout = other;
+}
+
+
+Sint64 event_loop_step(Uint64 now)
+{   /* Do everything that is due, then work out when we next have something
+     * to do: button repeats, text input typing and mouse movement.
+     *
+     * Returns how many ns the main loop can wait for events, -1 is forever.
+     * This way button presses are handled straight away even while the
+     * mouse is moving.
+     */
+    Sint64 timeout;
+
+    state_update();
+
+    if (!current_state.running)
+        return 0;
+
+    if (now >= event_next_mouse_tick)
+    {   /* The move is sized from the time since the last one, so waking up
+         * late doesn't slow the mouse down. The first move after stopping
+         * counts as one interval.
+         */
+        Uint64 interval = mouse_tick_interval();
+        Uint64 elapsed = (event_mouse_moving ? now - event_last_mouse_tick : interval);
+
+        if (elapsed > interval * EVENT_MOUSE_CATCH_UP)
+            elapsed = interval * EVENT_MOUSE_CATCH_UP;
+
+        event_mouse_moving = mouse_tick(elapsed);
+        event_last_mouse_tick = now;
+
+        if (event_mouse_moving)
+            GPTK2_STAT(mouse_ticks_moving);
+        else
+            GPTK2_STAT(mouse_ticks_idle);
+
+        if (event_mouse_moving)
+        {   // from the last deadline, unless we have fallen a whole tick behind.
+            event_next_mouse_tick += interval;
+
+            if (event_next_mouse_tick <= now)
+                event_next_mouse_tick = now + interval;
+        }
+    }
+
+    input_typing_update(now);
+    process_watch_update(now);
+
+    if (!current_state.running)
+        return 0;
+
+    timeout = timer_timeout(now);
+
+    event_timeout_min(&timeout, input_typing_timeout(now));
+    event_timeout_min(&timeout, process_watch_timeout(now));
+
+    if (event_mouse_moving)
+        event_timeout_min(&timeout, clock_until(event_next_mouse_tick, now));
+
+    return timeout;
+}
+
+
+bool event_wait(Sint64 timeout)
+{   /* Wait up to timeout ns (-1 is forever) for an event, then handle
+     * everything that is waiting. SDL only waits in whole ms.
+     *
+     * Returns false if waiting failed.
+     */
+    SDL_Event event;
+
+    if (evdev_mode)
+        return evdev_wait(timeout);
+
+    if (timeout < 0)
+    {
+        // GPTK2_DEBUG("-- WAIT FOR EVENT --\n");
+        if (!SDL_WaitEvent(&event))
+        {
+            printf("SDL_WaitEvent() failed: %s\n", SDL_GetError());
+            return false;
+        }
+
+        handleInputEvent(&event);
+    }
+    else if (SDL_WaitEventTimeout(&event, clock_timeout_ms(timeout)))
+    {
+        handleInputEvent(&event);
+    }
+
+    while (current_state.running && SDL_PollEvent(&event))
+    {
+        handleInputEvent(&event);
+    }
+
+    return true;
 }
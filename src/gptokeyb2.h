@@ -84,6 +84,15 @@
 // surely this is enough. :TurtleThink: 
 #define MAX_CONTROL_NAME 64
 
+#ifndef MAX_PATH
+#define MAX_PATH 1024
+#endif
+
+#define MAX_PROCESS_NAME 64
+
+// config files given with -c
+#define CONFIG_FILES_MAX 16
+
 // THIS IS REDICULOUS, STOP IT.
 #define CFG_STACK_MAX 16
 
@@ -108,6 +117,36 @@ enum
     DZ_HYBRID,
 };
 
+enum
+{   // Deadzone maths, see analog.c
+    DZM_TABLE,
+    DZM_FIXED,
+    DZM_FLOAT,
+};
+
+// the mouse deadzone maths gives 1/256ths of deadzone_scale, so slow moves add up.
+#define DEADZONE_FRAC_BITS 8
+#define DEADZONE_ONE (1 << DEADZONE_FRAC_BITS)
+
+enum
+{   // Stick response curves, see analog.c
+    CURVE_LINEAR,
+    CURVE_EXP,
+    CURVE_S,
+    CURVE_POINTS,
+};
+
+#define CURVE_POINTS_MAX 8
+
+typedef struct
+{   // a response curve, the values are Q16 so 1.0 is 65536.
+    int type;
+    int exponent;
+    int points;
+    int point_x[CURVE_POINTS_MAX];
+    int point_y[CURVE_POINTS_MAX];
+} analog_curve;
+
 
 // BUTTON DEFS
 enum
@@ -223,6 +262,13 @@ enum
     OVL_CLEAR,
 };
 
+enum
+{   // Analog sticks
+    ANALOG_NONE,
+    ANALOG_LEFT,
+    ANALOG_RIGHT,
+};
+
 // simple tokenizer
 typedef struct _token_ctx token_ctx;
 
@@ -249,7 +295,9 @@ typedef struct
 struct _gptokeyb_config
 {
     gptokeyb_config *next;
+    gptokeyb_config *hash_next;
     const char *name;
+    const char *name_key;
 
     const char *charset;
     const char *wordset;
@@ -287,8 +335,8 @@ typedef struct
     Uint32 mouse_move;
 
     Uint32 in_repeat;
-    Uint32 held_since[GBTN_MAX];
-    Uint32 next_repeat[GBTN_MAX];
+    // clock_now() ns, repeats are TIMER_REPEAT timers.
+    Uint64 held_since[GBTN_MAX];
 
     const gptokeyb_button *button_held[GBTN_MAX];
 
@@ -301,8 +349,15 @@ typedef struct
     int current_l2;
     int current_r2;
 
+    // the analog stick that last moved the mouse, see mouse_analog_update.
+    int mouse_analog_dirty;
+
+    // mouse movement per mouse_delay and what is left over from the last
+    // move, both in 1/DEADZONE_ONE units.
     int mouse_relative_x;
     int mouse_relative_y;
+    int mouse_remainder_x;
+    int mouse_remainder_y;
 
     bool absolute_invert_x;
     bool absolute_invert_y;
@@ -318,16 +373,27 @@ typedef struct
     int mouse_slow_scale;
     bool dpad_mouse_normalize;
 
+    // let the kernel repeat keys held on the fake keyboard.
+    bool kernel_repeat;
+
     int deadzone_mode;
+    int deadzone_math;
     int deadzone_scale;
 
     int deadzone_x;
     int deadzone_y;
     int deadzone_triggers;
 
+    analog_curve left_analog_curve;
+    analog_curve right_analog_curve;
+
     int hotkey_gbtn;
     bool running;
 
+    // how often the mouse moves, 0 is every mouse_delay.
+    int mouse_rate;
+
+    // ms, as set in the config
     Uint64 mouse_delay;
     Uint64 repeat_delay;
     Uint64 repeat_rate;
@@ -353,6 +419,7 @@ typedef struct {
 typedef struct _char_set {
     struct _char_set *next;
     const char *name;
+    const char *name_key;
     const char *characters;
     size_t characters_len;
     bool builtin;
@@ -362,12 +429,19 @@ typedef struct _char_set {
 typedef struct _word_set {
     struct _word_set *next;
     const char *name;
+    const char *name_key;
     const char **words;
     size_t words_len;
     size_t words_alloc;
 } word_set;
 
 
+typedef struct {
+    char file_name[MAX_PATH];
+    char game_prefix[MAX_PROCESS_NAME];
+} config_file;
+
+
 // Basic vector 2d class for better analog deadzone code
 typedef struct
 {
@@ -375,6 +449,19 @@ typedef struct
     float y;
 } vector2d;
 
+// The same in fixed point, 16 fractional bits.
+typedef struct
+{
+    Sint32 x;
+    Sint32 y;
+} vector2q;
+
+typedef struct
+{
+    Sint32 value;   // Q16
+    Sint64 radial;  // the smallest magnitude^2 outside the deadzone, Q32
+} deadzone_q16;
+
 
 // some stuff
 extern const keyboard_values keyboard_codes[];
@@ -406,6 +493,7 @@ extern bool current_right_analog_as_absolute_mouse;
 extern int xbox_uinp_fd; // fake xbox controller
 extern int kb_uinp_fd;   // fake relative mouse and keyboard
 extern int abs_uinp_fd;  // fake absolute position mouse
+extern int rep_uinp_fd;  // fake keyboard the kernel repeats keys on
 
 // stuff
 extern bool xbox360_mode;
@@ -415,8 +503,16 @@ extern bool want_pc_quit;
 extern bool want_kill;
 extern bool want_sudo;
 extern char kill_process_name[];
+extern char default_control[];
 
 extern char game_prefix[];
+extern char user_config_file[];
+
+extern config_file config_files[];
+extern int config_file_count;
+
+extern char_set *root_char_set;
+extern word_set *root_word_set;
 
 // config.c
 void config_init();
@@ -429,6 +525,14 @@ gptokeyb_config *config_find(const char *name);
 gptokeyb_config *config_create(const char *name);
 void config_free(gptokeyb_config *config);
 int config_load(const char *file_name, bool config_only);
+void config_add_file(const char *file_name);
+void config_load_files();
+int config_load_all(bool use_cache, bool user_config);
+void config_select_default(const char *control_name);
+
+// cache.c
+bool config_cache_load();
+void config_cache_save();
 
 // analog.c
 void vector2d_clear(vector2d *vec2d);
@@ -442,8 +546,33 @@ int deadzone_get_mode(const char *str);
 const char *deadzone_mode_str(int mode);
 void deadzone_trigger_calc(int *analog, int analog_in);
 void deadzone_mouse_calc(int *x, int *y, int in_x, int in_y);
+void deadzone_mouse_calc_float(int *x, int *y, int in_x, int in_y);
+void deadzone_mouse_calc_fixed(int *x, int *y, int in_x, int in_y);
+void deadzone_analog_calc(int analog, int *x, int *y, int in_x, int in_y);
+void deadzone_analog_calc_float(int analog, int *x, int *y, int in_x, int in_y);
+void deadzone_update();
+
+void analog_curve_reset(analog_curve *curve);
+void analog_curve_parse(analog_curve *curve, const char *value, token_ctx *token_state);
+void analog_curve_dump(const char *name, const analog_curve *curve);
+
+int deadzone_get_math(const char *str);
+const char *deadzone_math_str(int math);
+
+void dz_exp(vector2d *vec2d_ouput, const vector2d *vec2d_input, float deadzone, float n);
+
+Sint32 q16_pow(Sint32 value, Sint32 n);
+void deadzone_q16_set(deadzone_q16 *dz, int deadzone);
+void dzq_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_radial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_scaled_radial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_sloped_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_sloped_scaled_axial(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_hybrid(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz);
+void dzq_exp(vector2q *vec2q_output, const vector2q *vec2q_input, const deadzone_q16 *dz, Sint32 n);
 
 // keys.c
+void keys_init();
 const keyboard_values *find_keyboard(const char *key);
 const char *find_keycode(short keycode);
 const button_match *find_button(const char *key);
@@ -470,20 +599,25 @@ bool strcasestartswith(const char *str, const char *suffix);
 
 int strcasecmp(const char *s1, const char *s2);
 int strncasecmp(const char *s1, const char *s2, size_t n);
+Uint32 strcasehash(const char *str);
 
-bool process_kill();
+int signal_fd_open(int signum);
+int signal_fd_read(int fd);
 
 void string_init();
 void string_quit();
+void string_dump_stats();
 const char *string_register(const char *string);
+const char *string_casekey(const char *string, bool create);
 
 // from og gptokeyb
 void emit(int fd, int type, int code, int val);
+void emit_flush_all();
+Uint32 emit_drain(Uint32 max_wait);
 void emitRelativeMouseMotion(int x, int y);
 void emitAbsoluteMouseMotion(int x, int y);
 void emitMouseWheel(int wheel);
 void emitAxisMotion(int code, int value);
-void emitTextInputKey(int code, bool uppercase);
 void emitKey(int fd, int code, bool is_pressed, int modifier);
 void handleAnalogTrigger(bool is_triggered, bool *was_triggered, int key, int modifier);
 
@@ -508,6 +642,10 @@ void input_disable();
 
 bool input_active();
 
+void input_typing_update(Uint64 now);
+Sint64 input_typing_timeout(Uint64 now);
+void input_typing_flush();
+
 void input_set_state(const char *buff, size_t buff_len);
 void input_clear_state();
 
@@ -534,6 +672,9 @@ void update_button(int btn, bool pressed);
 
 void state_init();
 void state_quit();
+void state_config_defaults();
+void state_release_all();
+void state_reset();
 void state_update();
 gptokeyb_config *state_active();
 
@@ -549,13 +690,199 @@ void controller_add_fd(Sint32 which, int fd);
 void controller_remove_fd(Sint32 which);
 
 // event.c
+typedef void (*event_watch_func)(int fd, void *data);
+
 void handleInputEvent(const SDL_Event *event);
+void event_loop_init(Uint64 now);
+Sint64 event_loop_step(Uint64 now);
+bool event_wait(Sint64 timeout);
+bool event_watch_fd(int fd, event_watch_func func, void *data);
+void event_unwatch_fd(int fd);
+bool event_watch_ready(void *ptr);
+void event_quit();
+
+// process.c
+extern bool process_watch_mode;
+
+pid_t process_find(const char *process_name);
+int process_pidfd_open(pid_t pid);
+bool process_kill();
+
+void process_watch_update(Uint64 now);
+Sint64 process_watch_timeout(Uint64 now);
+void process_watch_quit();
+
+// trace.c
+extern bool trace_enabled;
+
+void trace_init();
+void trace_start();
+void trace_quit();
+void trace_dump();
+void trace_source(const struct timeval *time);
+void trace_ingress(const SDL_Event *event);
+void trace_resolve();
+void trace_write(int fd);
+void trace_done();
+
+// stats.c
+#ifdef GPTK2_STATS_ENABLED
+enum
+{
+    STATS_DEVICE_KB,
+    STATS_DEVICE_XBOX,
+    STATS_DEVICE_ABS,
+    STATS_DEVICES,
+};
+
+typedef struct
+{
+    Uint64 events_button;
+    Uint64 events_axis;
+    Uint64 events_device;
+    Uint64 events_watch;
+    Uint64 events_other;
+
+    Uint64 update_button;
+    Uint64 state_change_update;
+    Uint64 repeats;
+
+    Uint64 mouse_ticks_moving;
+    Uint64 mouse_ticks_idle;
+    Uint64 mouse_deadzone_calcs;
+
+    Uint64 uinput_writes[STATS_DEVICES];
+    Uint64 uinput_bytes[STATS_DEVICES];
+
+    Uint64 wakeups;
+} __attribute__((aligned(64))) gptk_stats_counters;
+
+extern gptk_stats_counters gptk_stats;
+
+void stats_write(int fd, size_t bytes);
+void stats_dump();
+
+#define GPTK2_STAT(counter) (gptk_stats.counter++)
+#define GPTK2_STAT_WRITE(fd, bytes) stats_write((fd), (bytes))
+#else
+#define GPTK2_STAT(counter) ((void)0)
+#define GPTK2_STAT_WRITE(fd, bytes) ((void)0)
+#endif
+
+void stats_init();
+void stats_start();
+void stats_quit();
+
+// clock.c
+#define NS_PER_MS  1000000ULL
+#define NS_PER_SEC 1000000000ULL
+#define MS_TO_NS(ms) ((Uint64)(ms) * NS_PER_MS)
+#define NS_TO_MS(ns) ((ns) / NS_PER_MS)
+
+Uint64 clock_monotonic_ns();
+Uint64 clock_now();
+void clock_delay(Uint64 ns);
+void clock_set_virtual(Uint64 ns);
+void clock_set_real();
+void clock_advance_to(Uint64 ns);
+Sint64 clock_until(Uint64 deadline, Uint64 now);
+int clock_timeout_ms(Sint64 timeout);
+
+// timer.c
+enum
+{
+    TIMER_REPEAT = 0,   // one per button
+    TIMER_COUNT = TIMER_REPEAT + GBTN_MAX,
+};
+
+typedef void (*timer_func)(int timer, Uint64 now);
+
+void timer_set(int timer, Uint64 deadline, timer_func func);
+void timer_cancel(int timer);
+void timer_cancel_all();
+bool timer_pending(int timer);
+void timer_run(Uint64 now);
+Sint64 timer_timeout(Uint64 now);
+
+// output.c
+#define OUTPUT_FD_KB   (-100)
+#define OUTPUT_FD_XBOX (-101)
+#define OUTPUT_FD_ABS  (-102)
+#define OUTPUT_FD_REP  (-103)
+
+typedef struct
+{
+    const char *name;
+    bool (*open)(const char *arg);
+    ssize_t (*write)(int fd, const struct input_event *events, size_t count);
+    void (*close)();
+} output_sink;
+
+typedef struct
+{
+    int fd;
+    struct input_event event;
+} output_event;
+
+bool output_select(const char *spec);
+void output_set_sink(const output_sink *sink);
+bool output_is_uinput();
+ssize_t output_write(int fd, const struct input_event *events, size_t count);
+size_t output_memory_read(output_event *events, size_t max);
+void output_quit();
+
+// record.c
+enum
+{
+    RECORD_BUTTON_DOWN = 1,
+    RECORD_BUTTON_UP,
+    RECORD_AXIS,
+};
+
+typedef struct
+{
+    Uint32 ticks;   // ms since recording started
+    Uint8 type;
+    Uint8 index;    // SDL button or axis
+    Sint16 value;
+} record_entry;
+
+extern bool record_enabled;
+
+bool record_open(const char *file_name);
+void record_event(const SDL_Event *event);
+void record_close();
+record_entry *record_load(const char *file_name, size_t *count);
+void record_to_event(const record_entry *entry, SDL_Event *event);
+
+// daemon.c
+extern bool daemon_mode;
+
+bool daemon_init(const char *socket_path);
+void daemon_quit();
+void daemon_target_quit();
+int daemon_client_main(const char *socket_path, int argc, char *argv[]);
+
+// evdev.c
+extern bool evdev_mode;
+
+void evdev_init();
+void evdev_quit();
+void evdev_add_controller(SDL_GameController *sdl_controller, int sdl_fd);
+bool evdev_wait(Sint64 timeout);
+bool evdev_watch_fd(int fd, void *ptr);
+void evdev_unwatch_fd(int fd);
 
 // keyboard.c
 void setupFakeKeyboardMouseDevice();
+void keyboard_set_repeat();
+bool keyboard_kernel_repeat();
+int keyboard_key_fd(const gptokeyb_button *button);
 void setupFakeAbsoluteMouseDevice();
 void handleEventBtnFakeKeyboardMouseDevice(const SDL_Event *event, bool is_pressed);
 void handleEventAxisFakeKeyboardMouseDevice(const SDL_Event *event);
+bool mouse_tick(Uint64 elapsed);
+Uint64 mouse_tick_interval();
 
 // xbox360.c
 void setupFakeXbox360Device();
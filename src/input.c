@@ -102,6 +102,23 @@ static size_t current_offset = 0;
 static int current_word = 0;
 static size_t current_word_len = 0;
 
+/* Typing queue, text input keys are typed from the main loop so we don't
+ * block while a long word is typed out.
+ */
+#define TYPING_QUEUE_MAX 256
+#define TYPING_KEY_DELAY 16
+
+typedef struct {
+    short keycode;
+    bool  shift;
+} typing_key;
+
+static typing_key typing_queue[TYPING_QUEUE_MAX];
+static size_t typing_head = 0;
+static size_t typing_len = 0;
+static bool typing_pressed = false;
+static Uint64 typing_next = 0;
+
 
 void input_rem_char();
 void input_add_char();
@@ -123,11 +140,16 @@ bool input_active()
 
 char_set *_find_char_set(const char *name)
 {
+    const char *name_key = string_casekey(name, false);
+
+    if (name_key == NULL)
+        return NULL;
+
     char_set *curr_char_set = root_char_set;
 
     while (curr_char_set != NULL)
     {
-        if (strcasecmp(name, curr_char_set->name) == 0)
+        if (curr_char_set->name_key == name_key)
         {
             return curr_char_set;
         }
@@ -152,12 +174,17 @@ const char_set *find_char_set(const char *name)
 
 word_set *_find_word_set(const char *name)
 {
+    const char *name_key = string_casekey(name, false);
+
+    if (name_key == NULL)
+        return NULL;
+
     word_set *curr_word_set = root_word_set;
     word_set *prev_word_set = NULL;
 
     while (curr_word_set != NULL)
     {
-        if (strcasecmp(name, curr_word_set->name) == 0)
+        if (curr_word_set->name_key == name_key)
         {
             if (prev_word_set != NULL)
             {   // unlink it
@@ -297,6 +324,7 @@ void register_char_set(const char *name, const char *characters)
     }
 
     new_char_set->name       = string_register(name);
+    new_char_set->name_key   = string_casekey(name, true);
     new_char_set->characters = string_register(characters);
     new_char_set->characters_len = strlen(characters);
     new_char_set->builtin    = char_set_builtin_mode;
@@ -328,6 +356,7 @@ void register_word_set(const char *name, const char *word)
         curr_word_set = (word_set*)gptk_malloc(sizeof(word_set));
 
         curr_word_set->name = string_register(name);
+        curr_word_set->name_key = string_casekey(name, true);
         curr_word_set->words = (const char **)gptk_malloc(sizeof(char*) * WORDS_SIZE_DEFAULT);
         curr_word_set->words_alloc = WORDS_SIZE_DEFAULT;
 
@@ -337,7 +366,7 @@ void register_word_set(const char *name, const char *word)
 
     if ((curr_word_set->words_len+1) >= curr_word_set->words_alloc)
     {   // resize the words buffer if we need to
-        size_t new_size = curr_word_set->words_alloc + WORDS_SIZE_DEFAULT;
+        size_t new_size = curr_word_set->words_alloc * 2;
 
         curr_word_set->words = (const char **)gptk_realloc(
             curr_word_set->words,
@@ -488,12 +517,103 @@ void input_stop()
 }
 
 
+static void input_typing_step(Uint64 now)
+{   // press or release the key at the head of the typing queue.
+    typing_key *key = &typing_queue[typing_head];
+
+    if (!typing_pressed)
+    {
+        emitKey(kb_uinp_fd, key->keycode, true, (key->shift ? MOD_SHIFT : 0));
+        typing_pressed = true;
+    }
+    else
+    {
+        emitKey(kb_uinp_fd, key->keycode, false, (key->shift ? MOD_SHIFT : 0));
+        typing_pressed = false;
+
+        typing_head = (typing_head + 1) % TYPING_QUEUE_MAX;
+        typing_len--;
+    }
+
+    typing_next = now + MS_TO_NS(TYPING_KEY_DELAY);
+}
+
+
+void input_typing_update(Uint64 now)
+{
+    while (typing_len > 0 && now >= typing_next)
+    {
+        input_typing_step(now);
+    }
+}
+
+
+void input_typing_flush()
+{   // drop anything left to type, releasing the key if it is held.
+    if (typing_pressed)
+    {
+        typing_key *key = &typing_queue[typing_head];
+
+        emitKey(kb_uinp_fd, key->keycode, false, (key->shift ? MOD_SHIFT : 0));
+        typing_pressed = false;
+    }
+
+    typing_head = 0;
+    typing_len = 0;
+}
+
+
+Sint64 input_typing_timeout(Uint64 now)
+{   // how many ns until the next typing key is due, -1 if there is nothing to type.
+    if (typing_len == 0)
+        return -1;
+
+    return clock_until(typing_next, now);
+}
+
+
+static void input_typing_queue(short keycode, bool shift)
+{
+    size_t tail;
+
+    if (keycode == KEY_BACKSPACE && typing_len > (typing_pressed ? 1 : 0))
+    {   // A backspace straight after a key we haven't typed yet cancels them both out.
+        tail = (typing_head + typing_len - 1) % TYPING_QUEUE_MAX;
+
+        if (typing_queue[tail].keycode != KEY_BACKSPACE && typing_queue[tail].keycode != KEY_ENTER)
+        {
+            typing_len--;
+            return;
+        }
+    }
+
+    while (typing_len >= TYPING_QUEUE_MAX)
+    {   // we're way behind, type the oldest key now.
+        Uint64 now = clock_now();
+
+        if (now < typing_next)
+            clock_delay(typing_next - now);
+
+        input_typing_step(clock_now());
+    }
+
+    if (typing_len == 0 && clock_now() >= typing_next)
+        typing_next = clock_now();
+
+    tail = (typing_head + typing_len) % TYPING_QUEUE_MAX;
+
+    typing_queue[tail].keycode = keycode;
+    typing_queue[tail].shift = shift;
+    typing_len++;
+}
+
+
 void input_rem_char()
 {
     // printf("input_rem_char\n");
     printf("input_rem_char\n");
 
-    emitTextInputKey(KEY_BACKSPACE, false);
+    input_typing_queue(KEY_BACKSPACE, false);
 }
 
 
@@ -501,13 +621,13 @@ void input_add_char()
 {
     if (characters[(unsigned char)input_text[current_offset]].keycode == 0)
     {
-        emitTextInputKey(
+        input_typing_queue(
             characters['?'].keycode,
             characters['?'].shift);
     }
     else
     {
-        emitTextInputKey(
+        input_typing_queue(
             characters[(unsigned char)input_text[current_offset]].keycode,
             characters[(unsigned char)input_text[current_offset]].shift);
     }
@@ -589,7 +709,7 @@ void input_accept()
 {
     printf("input_accept\n");
 
-    emitTextInputKey(KEY_ENTER, false);
+    input_typing_queue(KEY_ENTER, false);
     pop_state();
 }
 
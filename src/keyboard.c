@@ -42,7 +42,13 @@
 void setupFakeAbsoluteMouseDevice()
 {
     struct uinput_user_dev device;
-    
+
+    if (!output_is_uinput())
+    {   // headless, see output.c
+        abs_uinp_fd = OUTPUT_FD_ABS;
+        return;
+    }
+
     memset(&device, 0, sizeof(device));
     strncpy(device.name, "Fake Absolute Mouse", UINPUT_MAX_NAME_SIZE);
     device.id.vendor = 0x1235;  /* sample vendor */
@@ -98,7 +104,14 @@ void setupFakeAbsoluteMouseDevice()
 void setupFakeKeyboardMouseDevice()
 {
     struct uinput_user_dev device;
-    
+
+    if (!output_is_uinput())
+    {   // headless, see output.c
+        kb_uinp_fd = OUTPUT_FD_KB;
+        keyboard_set_repeat();
+        return;
+    }
+
     memset(&device, 0, sizeof(device));
     strncpy(device.name, "Fake Keyboard Mouse", UINPUT_MAX_NAME_SIZE);
     device.id.vendor = 0x1234;  /* sample vendor */
@@ -150,6 +163,91 @@ void setupFakeKeyboardMouseDevice()
         fprintf(stderr, "Unable to create keyboard UINPUT device: %d - %s\n", ret, strerror(errno));
         exit(255);
     }
+
+    keyboard_set_repeat();
+}
+
+
+static void setupFakeRepeatKeyboardDevice()
+{   /* A second keyboard with EV_REP, only keys bound with repeat are sent to
+     * it. With EV_REP on the main device the kernel would repeat every held
+     * key, modifiers and mouse buttons included.
+     */
+    struct uinput_user_dev device;
+
+    if (!output_is_uinput())
+    {   // headless, see output.c
+        rep_uinp_fd = OUTPUT_FD_REP;
+        return;
+    }
+
+    memset(&device, 0, sizeof(device));
+    strncpy(device.name, "Fake Keyboard Repeat", UINPUT_MAX_NAME_SIZE);
+    device.id.vendor = 0x1234;  /* sample vendor */
+    device.id.product = 0x5679; /* sample product */
+    device.id.version = 1;
+    device.id.bustype = BUS_USB;
+
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0)
+    {   // not fatal, the repeat timers are used instead.
+        fprintf(stderr, "Unable to open /dev/uinput for key repeat: %s\n", strerror(errno));
+        return;
+    }
+
+    for (int i = 1; i < 256; i++)
+    {
+        ioctl(fd, UI_SET_KEYBIT, i);
+    }
+
+    if (
+        ioctl(fd, UI_SET_EVBIT, EV_SYN) ||
+        ioctl(fd, UI_SET_EVBIT, EV_KEY) ||
+        ioctl(fd, UI_SET_EVBIT, EV_REP) ||
+        -1 == write(fd, &device, sizeof(device)) ||
+        ioctl(fd, UI_DEV_CREATE)
+        ) {
+        fprintf(stderr, "Unable to create key repeat UINPUT device: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    rep_uinp_fd = fd;
+}
+
+
+bool keyboard_kernel_repeat()
+{
+    return (rep_uinp_fd != 0 && current_state.kernel_repeat);
+}
+
+
+int keyboard_key_fd(const gptokeyb_button *button)
+{   // keys bound with repeat go to the repeat keyboard, see state_repeat_start.
+    if (button->repeat && keyboard_kernel_repeat() && button->keycode > 0 && button->keycode < 256)
+        return rep_uinp_fd;
+
+    return kb_uinp_fd;
+}
+
+
+void keyboard_set_repeat()
+{   /* Hand repeat_delay and repeat_rate to the kernel, the repeat keyboard is
+     * made the first time kernel_repeat is on. A delay of 0 turns the repeat
+     * off if kernel_repeat has been turned off since.
+     */
+    if (current_state.kernel_repeat && rep_uinp_fd == 0)
+        setupFakeRepeatKeyboardDevice();
+
+    if (rep_uinp_fd == 0)
+        return;
+
+    int delay  = (current_state.kernel_repeat ? (int)current_state.repeat_delay : 0);
+    int period = (current_state.kernel_repeat ? (int)current_state.repeat_rate  : 0);
+
+    emit(rep_uinp_fd, EV_REP, REP_DELAY,  delay);
+    emit(rep_uinp_fd, EV_REP, REP_PERIOD, period);
+    emit(rep_uinp_fd, EV_SYN, SYN_REPORT, 0);
 }
 
 
@@ -265,23 +363,14 @@ void handleEventAxisFakeKeyboardMouseDevice(const SDL_Event *event)
         break;
     } // switch (event->caxis.axis)
 
-    // fake mouse
+    // fake mouse, the deadzone is worked out on the next mouse_tick.
     if (current_left_analog_as_mouse && left_axis_movement)
     {
-        deadzone_mouse_calc(
-            &current_state.mouse_relative_x, &current_state.mouse_relative_y,
-            current_state.current_left_analog_x, current_state.current_left_analog_y);
-
-        // GPTK2_DEBUG("fake mouse %d %d\n", current_state.mouse_x, current_state.mouse_y);
-
+        current_state.mouse_analog_dirty = ANALOG_LEFT;
     }
     else if (current_right_analog_as_mouse && right_axis_movement)
     {
-        deadzone_mouse_calc(
-            &current_state.mouse_relative_x, &current_state.mouse_relative_y,
-            current_state.current_right_analog_x, current_state.current_right_analog_y);
-
-        // GPTK2_DEBUG("fake mouse %d %d\n", current_state.mouse_x, current_state.mouse_y);
+        current_state.mouse_analog_dirty = ANALOG_RIGHT;
     }
     else if (current_left_analog_as_absolute_mouse && left_axis_movement)
     {
@@ -321,3 +410,158 @@ void handleEventAxisFakeKeyboardMouseDevice(const SDL_Event *event)
     if (r2_movement)
         update_button(GBTN_R2, current_state.current_r2 > current_state.deadzone_triggers);
 }
+
+
+static void mouse_analog_update()
+{   /* Sticks send far more axis events than we have mouse ticks, so they only
+     * store the raw values and we do the deadzone here, once per tick for the
+     * stick that moved last.
+     */
+    int analog = current_state.mouse_analog_dirty;
+
+    current_state.mouse_analog_dirty = ANALOG_NONE;
+
+    if (analog == ANALOG_LEFT && current_left_analog_as_mouse)
+    {
+        GPTK2_STAT(mouse_deadzone_calcs);
+        deadzone_analog_calc(ANALOG_LEFT,
+            &current_state.mouse_relative_x, &current_state.mouse_relative_y,
+            current_state.current_left_analog_x, current_state.current_left_analog_y);
+
+        // GPTK2_DEBUG("fake mouse %d %d\n", current_state.mouse_x, current_state.mouse_y);
+    }
+    else if (analog == ANALOG_RIGHT && current_right_analog_as_mouse)
+    {
+        GPTK2_STAT(mouse_deadzone_calcs);
+        deadzone_analog_calc(ANALOG_RIGHT,
+            &current_state.mouse_relative_x, &current_state.mouse_relative_y,
+            current_state.current_right_analog_x, current_state.current_right_analog_y);
+
+        // GPTK2_DEBUG("fake mouse %d %d\n", current_state.mouse_x, current_state.mouse_y);
+    }
+}
+
+
+Uint64 mouse_tick_interval()
+{   // ns between mouse_tick calls while the mouse is moving.
+    if (current_state.mouse_rate > 0)
+        return NS_PER_SEC / (Uint64)current_state.mouse_rate;
+
+    return MS_TO_NS(current_state.mouse_delay);
+}
+
+
+bool mouse_tick(Uint64 elapsed)
+{   /* Move the fake mouse once, returns true if the mouse moved.
+     *
+     * This is called from the main loop every mouse_tick_interval while the
+     * mouse is moving, elapsed is the ns since the last call. The speed is
+     * always per mouse_delay, with mouse_rate the move is sized by elapsed
+     * so only how often it moves changes. Moves are worked out in
+     * 1/DEADZONE_ONE units and what doesn't make a whole unit is kept for the
+     * next one, so slow moves still get there.
+     */
+    int mouse_x=0;
+    int mouse_y=0;
+    bool mouse_moved=false;
+    vector2d mouse_move;
+
+    mouse_analog_update();
+
+    if (current_state.mouse_relative_x != 0 ||
+        current_state.mouse_relative_y != 0 ||
+        current_dpad_as_mouse)
+    {
+        Sint64 move_x = current_state.mouse_relative_x;
+        Sint64 move_y = current_state.mouse_relative_y;
+
+        if (current_dpad_as_mouse > 0)
+        {
+            vector2d_clear(&mouse_move);
+
+            mouse_move.x -= (is_pressed(GBTN_DPAD_LEFT ) ? 1.0f : 0.0f);
+            mouse_move.x += (is_pressed(GBTN_DPAD_RIGHT) ? 1.0f : 0.0f);
+            mouse_move.y -= (is_pressed(GBTN_DPAD_UP   ) ? 1.0f : 0.0f);
+            mouse_move.y += (is_pressed(GBTN_DPAD_DOWN ) ? 1.0f : 0.0f);
+
+            if (current_state.dpad_mouse_normalize)
+                vector2d_normalize(&mouse_move);
+
+            move_x += (Sint64)(mouse_move.x * (float)(current_state.dpad_mouse_step * DEADZONE_ONE));
+            move_y += (Sint64)(mouse_move.y * (float)(current_state.dpad_mouse_step * DEADZONE_ONE));
+        }
+
+        if (current_state.mouse_slow)
+        {
+            move_x = move_x * current_state.mouse_slow_scale / 100;
+            move_y = move_y * current_state.mouse_slow_scale / 100;
+        }
+
+        if (current_state.mouse_rate > 0)
+        {
+            Sint64 delay = (Sint64)MS_TO_NS(current_state.mouse_delay);
+
+            move_x = move_x * (Sint64)elapsed / delay;
+            move_y = move_y * (Sint64)elapsed / delay;
+        }
+
+        if (move_x != 0 || move_y != 0)
+        {
+            move_x += current_state.mouse_remainder_x;
+            move_y += current_state.mouse_remainder_y;
+
+            mouse_x = (int)(move_x / DEADZONE_ONE);
+            mouse_y = (int)(move_y / DEADZONE_ONE);
+
+            current_state.mouse_remainder_x = (int)(move_x - (Sint64)mouse_x * DEADZONE_ONE);
+            current_state.mouse_remainder_y = (int)(move_y - (Sint64)mouse_y * DEADZONE_ONE);
+
+            emitRelativeMouseMotion(mouse_x, mouse_y);
+
+            // keep going while the stick is held, even if it hasn't made a whole unit yet.
+            mouse_moved=true;
+
+            if (mouse_x != 0 || mouse_y != 0)
+                GPTK2_DEBUG("relative mouse move %d %d\n", mouse_x, mouse_y);
+        }
+        else
+        {   // let go, don't save part of a move for the next time.
+            current_state.mouse_remainder_x = 0;
+            current_state.mouse_remainder_y = 0;
+        }
+    }
+    else
+    {
+        current_state.mouse_remainder_x = 0;
+        current_state.mouse_remainder_y = 0;
+    }
+
+    if (current_state.mouse_absolute_x != 0 || current_state.mouse_absolute_y != 0)
+    {
+        if (current_state.absolute_rotate == 90) {
+            mouse_x = current_state.absolute_center_x + (current_state.absolute_step * -current_state.mouse_absolute_y / INT16_MAX);
+            mouse_y = current_state.absolute_center_y + (current_state.absolute_step * current_state.mouse_absolute_x / INT16_MAX);
+        }
+        else if (current_state.absolute_rotate == 180) {
+            mouse_x = current_state.absolute_center_x + (current_state.absolute_step * -current_state.mouse_absolute_x / INT16_MAX);
+            mouse_y = current_state.absolute_center_y + (current_state.absolute_step * -current_state.mouse_absolute_y / INT16_MAX);
+        }
+        else if (current_state.absolute_rotate == 270) {
+            mouse_x = current_state.absolute_center_x + (current_state.absolute_step * current_state.mouse_absolute_y / INT16_MAX);
+            mouse_y = current_state.absolute_center_y + (current_state.absolute_step * -current_state.mouse_absolute_x / INT16_MAX);
+        }
+        else {
+            mouse_x = current_state.absolute_center_x + (current_state.absolute_step * current_state.mouse_absolute_x / INT16_MAX);
+            mouse_y = current_state.absolute_center_y + (current_state.absolute_step * current_state.mouse_absolute_y / INT16_MAX);
+        }
+
+        if (abs(mouse_x - current_state.absolute_center_x) > current_state.absolute_deadzone ||
+            abs(mouse_y - current_state.absolute_center_y) > current_state.absolute_deadzone) {
+
+            emitAbsoluteMouseMotion(mouse_x, mouse_y);
+            mouse_moved=true;
+        }
+    }
+
+    return mouse_moved;
+}
@@ -222,37 +222,69 @@ const keyboard_values keyboard_codes[] = {
 
 
 
-const keyboard_values *find_keyboard(const char *key)
+#define KEYBOARD_CODES_MAX (sizeof(keyboard_codes) / sizeof(keyboard_codes[0]))
+
+// keyboard_codes sorted case-insensitively, ties are kept in table order.
+static short keyboard_index[KEYBOARD_CODES_MAX];
+
+// keycode -> first name in keyboard_codes.
+static const char *keycode_names[KEY_CNT];
+
+
+static int keyboard_index_cmp(const void *a, const void *b)
 {
-    int num_pairs = sizeof(keyboard_codes) / sizeof(keyboard_codes[0]);
+    short ia = *(const short *)a;
+    short ib = *(const short *)b;
+
+    int result = strcasecmp(keyboard_codes[ia].str, keyboard_codes[ib].str);
+
+    if (result != 0)
+        return result;
+
+    return ia - ib;
+}
+
+
+const keyboard_values *find_keyboard(const char *key)
+{   // exact matches win over case-insensitive matches, otherwise the first entry in the table.
+    int low = 0;
+    int high = KEYBOARD_CODES_MAX;
 
-    for (int i=0; i < num_pairs; i++)
+    // find the first case-insensitive match.
+    while (low < high)
     {
-        if (strcmp(key, keyboard_codes[i].str) == 0)
-            return &keyboard_codes[i];
+        int mid = (low + high) / 2;
+
+        if (strcasecmp(keyboard_codes[keyboard_index[mid]].str, key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
     }
 
-    for (int i=0; i < num_pairs; i++)
+    if (low >= (int)KEYBOARD_CODES_MAX || strcasecmp(keyboard_codes[keyboard_index[low]].str, key) != 0)
+        return NULL;
+
+    for (int i=low; i < (int)KEYBOARD_CODES_MAX; i++)
     {
-        if (strcasecmp(key, keyboard_codes[i].str) == 0)
-            return &keyboard_codes[i];
+        const keyboard_values *keyinfo = &keyboard_codes[keyboard_index[i]];
+
+        if (strcasecmp(keyinfo->str, key) != 0)
+            break;
+
+        if (strcmp(keyinfo->str, key) == 0)
+            return keyinfo;
     }
 
-    return NULL;
+    return &keyboard_codes[keyboard_index[low]];
 }
 
 
 const char *find_keycode(short keycode)
 {
-    int num_pairs = sizeof(keyboard_codes) / sizeof(keyboard_codes[0]);
+    if (keycode < 0 || keycode >= KEY_CNT || keycode_names[keycode] == NULL)
+        return "(null)";
 
-    for (int i=0; i < num_pairs; i++)
-    {
-        if (keycode == keyboard_codes[i].keycode)
-            return keyboard_codes[i].str;
-    }
-
-    return "(null)";
+    return keycode_names[keycode];
 }
 
 const button_match button_codes[] = {
@@ -305,16 +337,44 @@ void set_hotkey(int gbtn)
     button_hotkey.gbtn = gbtn;
 }
 
+#define BUTTON_CODES_MAX (sizeof(button_codes) / sizeof(button_codes[0]))
+
+// button_codes sorted case-insensitively.
+static short button_index[BUTTON_CODES_MAX];
+
+
+static int button_index_cmp(const void *a, const void *b)
+{
+    short ia = *(const short *)a;
+    short ib = *(const short *)b;
+
+    int result = strcasecmp(button_codes[ia].str, button_codes[ib].str);
+
+    if (result != 0)
+        return result;
+
+    return ia - ib;
+}
+
+
 const button_match *find_button(const char *key)
 {
-    int num_pairs = sizeof(button_codes) / sizeof(button_codes[0]);
+    int low = 0;
+    int high = BUTTON_CODES_MAX;
 
-    for (int i=0; i < num_pairs; i++)
+    while (low < high)
     {
-        if (strcasecmp(key, button_codes[i].str) == 0)
-            return &button_codes[i];
+        int mid = (low + high) / 2;
+
+        if (strcasecmp(button_codes[button_index[mid]].str, key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
     }
 
+    if (low < (int)BUTTON_CODES_MAX && strcasecmp(button_codes[button_index[low]].str, key) == 0)
+        return &button_codes[button_index[low]];
+
     if (strcasecmp(key, button_hotkey.str) == 0)
     {
         return &button_hotkey;
@@ -322,3 +382,28 @@ const button_match *find_button(const char *key)
 
     return NULL;
 }
+
+
+void keys_init()
+{   // Build the lookup indexes for the key and button tables.
+    for (int i=0; i < (int)KEYBOARD_CODES_MAX; i++)
+        keyboard_index[i] = i;
+
+    qsort(keyboard_index, KEYBOARD_CODES_MAX, sizeof(keyboard_index[0]), keyboard_index_cmp);
+
+    for (int i=0; i < KEY_CNT; i++)
+        keycode_names[i] = NULL;
+
+    for (int i=KEYBOARD_CODES_MAX-1; i >= 0; i--)
+    {
+        short keycode = keyboard_codes[i].keycode;
+
+        if (keycode >= 0 && keycode < KEY_CNT)
+            keycode_names[keycode] = keyboard_codes[i].str;
+    }
+
+    for (int i=0; i < (int)BUTTON_CODES_MAX; i++)
+        button_index[i] = i;
+
+    qsort(button_index, BUTTON_CODES_MAX, sizeof(button_index[0]), button_index_cmp);
+}
@@ -39,32 +39,17 @@
 #include <linux/uinput.h>
 #include <stdbool.h>
 
-#define MAX_PROCESS_NAME 64
+// the longest we wait for the last events to be read before destroying the devices.
+#define SHUTDOWN_DRAIN_MAX_MS 100
 
-#ifndef MAX_PATH
-#define MAX_PATH 1024
-#endif
 
-// ioctls prevent these from being on the same fd
-int xbox_uinp_fd = 0; // fake xbox controller
-int kb_uinp_fd = 0;  // fake relative mouse and keyboard
-int abs_uinp_fd = 0; // fake absolute position mouse
-
-bool xbox360_mode=false;
-bool config_mode=false;
-
-bool want_pc_quit = false;
-bool want_kill = false;
-bool want_sudo = false;
-
-char user_config_file[MAX_PATH];
-
-char game_prefix[MAX_PROCESS_NAME] = "";
-char kill_process_name[MAX_PROCESS_NAME] = "";
-
-
-gptokeyb_config *default_config=NULL;
+static void shutdown_step(const char *step, Uint32 *step_ticks)
+{
+    Uint32 current_ticks = SDL_GetTicks();
 
+    printf("Shutdown: %s %ums\n", step, (unsigned)(current_ticks - *step_ticks));
+    *step_ticks = current_ticks;
+}
 
 
 int main(int argc, char* argv[])
@@ -72,6 +57,7 @@ int main(int argc, char* argv[])
     bool do_dump_config = false;
 
     string_init();
+    keys_init();
     state_init();
     config_init();
     input_init();
@@ -79,6 +65,7 @@ int main(int argc, char* argv[])
     xbox_uinp_fd = 0;
     kb_uinp_fd = 0;
     abs_uinp_fd = 0;
+    rep_uinp_fd = 0;
 
     char* env_home = SDL_getenv("HOME");
     if (env_home)
@@ -121,7 +108,10 @@ int main(int argc, char* argv[])
     }
 
     int opt;
-    char default_control[MAX_CONTROL_NAME] = "";
+    char daemon_socket[MAX_PATH] = "";
+    char client_socket[MAX_PATH] = "";
+    char record_file[MAX_PATH] = "";
+    char output_spec[MAX_PATH] = "";
 
     // Fix some old gptokeyb settings.
     for (int k=0; k < argc; k++)
@@ -132,7 +122,7 @@ int main(int argc, char* argv[])
         }
     }
 
-    while ((opt = getopt(argc, argv, "vk1g:hdxp:c:ZXPH:s:")) != -1)
+    while ((opt = getopt(argc, argv, "vk1g:hdexwp:c:ZXPH:s:D:C:R:O:")) != -1)
     {
         switch (opt)
         {
@@ -203,11 +193,40 @@ int main(int argc, char* argv[])
             break;
 
         case 'c':
-            config_load(optarg, false);
+            config_add_file(optarg);
             config_mode = true;
             xbox360_mode = false;
             break;
 
+        case 'e':
+            if (!evdev_mode)
+            {
+                printf("Using evdev input mode.\n");
+                evdev_mode = true;
+            }
+            break;
+
+        case 'w':
+            process_watch_mode = true;
+            break;
+
+        case 'D':
+            strncpy(daemon_socket, optarg, MAX_PATH - 1);
+            daemon_mode = true;
+            break;
+
+        case 'C':
+            strncpy(client_socket, optarg, MAX_PATH - 1);
+            break;
+
+        case 'R':
+            strncpy(record_file, optarg, MAX_PATH - 1);
+            break;
+
+        case 'O':
+            strncpy(output_spec, optarg, MAX_PATH - 1);
+            break;
+
         case 'x':
             config_mode = false;
             xbox360_mode = true;
@@ -232,19 +251,26 @@ int main(int argc, char* argv[])
                 fprintf(stderr, "\n");
             }
 
-            fprintf(stderr, "Usage: %s <program> [-dPXZ] [-H hotkey] [-c <config.ini>] [-p control_mode]\n",
+            fprintf(stderr, "Usage: %s <program> [-dePXZw] [-H hotkey] [-D socket] [-c <config.ini>] [-p control_mode]\n",
                 argv[0]);
             fprintf(stderr, "\n");
             fprintf(stderr, "Args:\n");
             fprintf(stderr, "  -P                  - pc quit mode (sends alt + f4 to quit program)\n");
             fprintf(stderr, "  -X                  - uses kill to quit the program\n");
             fprintf(stderr, "  -Z                  - uses pkill to quit the program\n");
+            fprintf(stderr, "  -w                  - quit when the program exits\n");
             fprintf(stderr, "\n");
             fprintf(stderr, "  -g  \"game_prefix\"   - game prefix used to allow per-game config.\n");
             fprintf(stderr, "  -x                  - xbox360 mode.\n");
+            fprintf(stderr, "  -e                  - read controllers directly with evdev instead of SDL.\n");
             fprintf(stderr, "  -c  \"config.ini\"    - config file to load.\n");
             fprintf(stderr, "  -p  \"control\"       - what control mode to start in.\n");
             fprintf(stderr, "\n");
+            fprintf(stderr, "  -D  \"socket\"        - daemon mode, listen for commands on this socket.\n");
+            fprintf(stderr, "  -C  \"socket\" cmd    - send a command to a daemon and print the reply.\n");
+            fprintf(stderr, "\n");
+            fprintf(stderr, "  -R  \"file\"          - record controller events for gptokeyb2-bench.\n");
+            fprintf(stderr, "  -O  output          - send output to null, memory or file:path instead of uinput.\n");
             fprintf(stderr, "  -d                  - dump config parsed.\n");
             fprintf(stderr, "  -v                  - print version and quit.");
             fprintf(stderr, "\n");
@@ -261,6 +287,22 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (strlen(client_socket) > 0)
+    {
+        int result = daemon_client_main(client_socket, argc - optind, &argv[optind]);
+
+        config_quit();
+        state_quit();
+        input_quit();
+        string_quit();
+        return result;
+    }
+
+    if (daemon_mode && !config_mode && !xbox360_mode)
+    {   // the daemon always needs some devices to keep around.
+        config_mode = true;
+    }
+
     for (int index=optind, i=0; index < argc; index++, i++)
     {
         if (i == 0)
@@ -296,57 +338,27 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (config_mode)
-    {
-        if (!do_dump_config && access(user_config_file, F_OK) == 0)
-        // if (access(user_config_file, F_OK) == 0)
-        {
-            printf("Loading '%s'\n", user_config_file);
-
-            if (config_load(user_config_file, true))
-            {
-                config_quit();
-                state_quit();
-                input_quit();
-                string_quit();
-                return 1;
-            }
-        }
+    // the cache is skipped when dumping so the dump always reflects the files.
+    bool use_config_cache = (config_mode && !do_dump_config);
 
-        if (strlen(default_control_name) > 0)
-        {
-            default_config = config_find(default_control_name);
-
-            if (default_config == NULL)
-            {
-                fprintf(stderr, "Unable to find control '%s'\n", default_control_name);
-            }
-        }
-
-        if (default_config == NULL && strlen(default_control) > 0)
-        {
-            default_config = config_find(default_control);
-
-            if (default_config == NULL)
-            {
-                fprintf(stderr, "Unable to find control '%s'\n", default_control);
-            }
-        }
-
-        if (default_config == NULL)
-        {
-            default_config = root_config;
-        }
-
-        config_stack[0] = default_config;
+    if (config_load_all(use_config_cache, use_config_cache))
+    {
+        config_quit();
+        state_quit();
+        input_quit();
+        string_quit();
+        return 1;
     }
 
-    config_finalise();
+    if (config_mode)
+        config_select_default(default_control);
+
     state_change_update();
 
     if (do_dump_config)
     {
         config_dump();
+        string_dump_stats();
         config_quit();
         state_quit();
         input_quit();
@@ -360,6 +372,9 @@ int main(int argc, char* argv[])
     if (strlen(game_prefix) > 0)
         printf("Game prefix '%s'\n", game_prefix);
 
+    trace_init();
+    stats_init();
+
     // SDL initialization and main loop
     if (SDL_Init(SDL_INIT_GAMECONTROLLER | SDL_INIT_TIMER) != 0)
     {
@@ -367,6 +382,9 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    if (strlen(output_spec) > 0 && !output_select(output_spec))
+        return 1;
+
     // Create fake input devices
     if (config_mode || xbox360_mode)
     {
@@ -397,133 +415,108 @@ int main(int argc, char* argv[])
         SDL_GameControllerAddMappingsFromFile(db_file);
     }
 
+    if (evdev_mode)
+        evdev_init();
+
+    trace_start();
+    stats_start();
+
+    int exit_code = 0;
+
+    if (daemon_mode && !daemon_init(daemon_socket))
+    {
+        current_state.running = false;
+        exit_code = 1;
+    }
+
+    if (strlen(record_file) > 0 && !record_open(record_file))
+    {
+        current_state.running = false;
+        exit_code = 1;
+    }
+
     SDL_Event event;
-    int mouse_x=0;
-    int mouse_y=0;
-    bool mouse_moved=false;
-    vector2d mouse_move;
-    float slow_scale = (100.0 / (float)(current_state.mouse_slow_scale));
+    Sint64 timeout;
+
+    // Pick up any controllers that are already connected.
+    while (current_state.running && SDL_PollEvent(&event))
+    {
+        handleInputEvent(&event);
+    }
+
+    event_loop_init(clock_now());
 
     while (current_state.running)
     {
-        while (current_state.running && SDL_PollEvent(&event))
-        {
-            handleInputEvent(&event);
-        }
+        timeout = event_loop_step(clock_now());
 
-        mouse_x=0;
-        mouse_y=0;
-        mouse_moved = false;
+        if (!current_state.running)
+            break;
 
-        state_update();
+        if (!event_wait(timeout))
+            return -1;
 
-        if (current_state.mouse_relative_x != 0 ||
-            current_state.mouse_relative_y != 0 ||
-            current_dpad_as_mouse)
-        {
-            mouse_x = current_state.mouse_relative_x;
-            mouse_y = current_state.mouse_relative_y;
+        GPTK2_STAT(wakeups);
+    }
 
-            if (current_dpad_as_mouse > 0)
-            {
-                vector2d_clear(&mouse_move);
+    /* Shut down, nothing can be left held down once the devices are gone.
+     * We only wait as long as it takes for the last events to be read.
+     */
+    Uint32 shutdown_ticks = SDL_GetTicks();
+    Uint32 step_ticks = shutdown_ticks;
 
-                mouse_move.x -= (is_pressed(GBTN_DPAD_LEFT ) ? 1.0f : 0.0f);
-                mouse_move.x += (is_pressed(GBTN_DPAD_RIGHT) ? 1.0f : 0.0f);
-                mouse_move.y -= (is_pressed(GBTN_DPAD_UP   ) ? 1.0f : 0.0f);
-                mouse_move.y += (is_pressed(GBTN_DPAD_DOWN ) ? 1.0f : 0.0f);
+    state_release_all();
+    shutdown_step("release", &step_ticks);
 
-                if (current_state.dpad_mouse_normalize)
-                    vector2d_normalize(&mouse_move);
+    emit_drain(SHUTDOWN_DRAIN_MAX_MS);
+    shutdown_step("drain", &step_ticks);
 
-                mouse_x += (int)(mouse_move.x * current_state.dpad_mouse_step);
-                mouse_y += (int)(mouse_move.y * current_state.dpad_mouse_step);
-            }
+    if (daemon_mode)
+        daemon_quit();
 
-            if (current_state.mouse_slow)
-            {
-                mouse_x = (int)((float)(mouse_x) / slow_scale);
-                mouse_y = (int)((float)(mouse_y) / slow_scale);
-            }
+    process_watch_quit();
+    trace_quit();
+    stats_quit();
+    record_close();
+    event_quit();
 
-            emitRelativeMouseMotion(mouse_x, mouse_y);
+    if (evdev_mode)
+        evdev_quit();
 
-            if (mouse_x != 0 || mouse_y != 0) {
-                mouse_moved=true;
-                GPTK2_DEBUG("relative mouse move %d %d\n", mouse_x, mouse_y);
-            }
-        }
+    shutdown_step("input", &step_ticks);
 
-        if (current_state.mouse_absolute_x != 0 || current_state.mouse_absolute_y != 0)
-        {
-            if (current_state.absolute_rotate == 90) {
-                mouse_x = current_state.absolute_center_x + (current_state.absolute_step * -current_state.mouse_absolute_y / INT16_MAX);
-                mouse_y = current_state.absolute_center_y + (current_state.absolute_step * current_state.mouse_absolute_x / INT16_MAX);
-            }
-            else if (current_state.absolute_rotate == 180) { 
-                mouse_x = current_state.absolute_center_x + (current_state.absolute_step * -current_state.mouse_absolute_x / INT16_MAX);
-                mouse_y = current_state.absolute_center_y + (current_state.absolute_step * -current_state.mouse_absolute_y / INT16_MAX);
-            }
-            else if (current_state.absolute_rotate == 270) {
-                mouse_x = current_state.absolute_center_x + (current_state.absolute_step * current_state.mouse_absolute_y / INT16_MAX);
-                mouse_y = current_state.absolute_center_y + (current_state.absolute_step * -current_state.mouse_absolute_x / INT16_MAX);
-            }
-            else {
-                mouse_x = current_state.absolute_center_x + (current_state.absolute_step * current_state.mouse_absolute_x / INT16_MAX);
-                mouse_y = current_state.absolute_center_y + (current_state.absolute_step * current_state.mouse_absolute_y / INT16_MAX);
-            }
-            
-            if (abs(mouse_x - current_state.absolute_center_x) > current_state.absolute_deadzone ||
-                abs(mouse_y - current_state.absolute_center_y) > current_state.absolute_deadzone) {
-                
-                emitAbsoluteMouseMotion(mouse_x, mouse_y);
-                mouse_moved=true;
-            }
+    /* Clean up, there are no devices when running headless. */
+    if (output_is_uinput())
+    {
+        if (kb_uinp_fd) {
+            ioctl(kb_uinp_fd, UI_DEV_DESTROY);
+            close(kb_uinp_fd);
         }
-
-        if (mouse_moved) {
-            // sleep.
-            // TODO: FIX ME
-            SDL_Delay(current_state.mouse_delay);
+        if (xbox_uinp_fd) {
+            ioctl(xbox_uinp_fd, UI_DEV_DESTROY);
+            close(xbox_uinp_fd);
         }
-        else {
-            // GPTK2_DEBUG("-- WAIT FOR EVENT --\n");
-            if (!SDL_WaitEvent(&event))
-            {
-                printf("SDL_WaitEvent() failed: %s\n", SDL_GetError());
-                return -1;
-            }
-
-            handleInputEvent(&event);
+        if (abs_uinp_fd) {
+            ioctl(abs_uinp_fd, UI_DEV_DESTROY);
+            close(abs_uinp_fd);
+        }
+        if (rep_uinp_fd) {
+            ioctl(rep_uinp_fd, UI_DEV_DESTROY);
+            close(rep_uinp_fd);
         }
     }
 
-    SDL_Quit();
+    output_quit();
+    shutdown_step("devices", &step_ticks);
 
-    /*
-     * Give userspace some time to read the events before we destroy the
-     * device with UI_DEV_DESTROY.
-     */
-    sleep(1);
+    printf("Shutdown took %ums\n", (unsigned)(SDL_GetTicks() - shutdown_ticks));
 
-    /* Clean up */
-    if (kb_uinp_fd) {
-        ioctl(kb_uinp_fd, UI_DEV_DESTROY);
-        close(kb_uinp_fd);
-    }
-    if (xbox_uinp_fd) {
-        ioctl(xbox_uinp_fd, UI_DEV_DESTROY);
-        close(xbox_uinp_fd);
-    }
-    if (abs_uinp_fd) {
-        ioctl(abs_uinp_fd, UI_DEV_DESTROY);
-        close(abs_uinp_fd);
-    }
+    SDL_Quit();
 
     config_quit();
     state_quit();
     input_quit();
     string_quit();
 
-    return 0;
+    return exit_code;
 }
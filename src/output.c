@@ -0,0 +1,310 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+
+/* Where the uinput frames from emit() end up.
+ *
+ * Normally they are written to the uinput devices, but gptokeyb2 can also
+ * run headless with -O, no devices are created and the output goes to:
+ *
+ *   null        - dropped, only counted.
+ *   memory      - the last OUTPUT_MEMORY_EVENTS events are kept in a ring
+ *                 buffer, see output_memory_read.
+ *   file:path   - one line per event, easy to diff.
+ *
+ * In headless mode the device fds are the OUTPUT_FD_* placeholders, so
+ * everything that picks a device by fd keeps working.
+ */
+
+#define OUTPUT_MEMORY_EVENTS 65536
+
+static ssize_t output_uinput_write(int fd, const struct input_event *events, size_t count)
+{
+    return write(fd, events, sizeof(struct input_event) * count);
+}
+
+static const output_sink output_uinput = {
+    .name = "uinput",
+    .write = output_uinput_write,
+};
+
+
+static ssize_t output_null_write(int fd, const struct input_event *events, size_t count)
+{
+    (void)fd;
+    (void)events;
+
+    return (ssize_t)(sizeof(struct input_event) * count);
+}
+
+static const output_sink output_null = {
+    .name = "null",
+    .write = output_null_write,
+};
+
+
+static output_event *output_memory_ring = NULL;
+static size_t output_memory_head = 0;
+static size_t output_memory_count = 0;
+
+
+static bool output_memory_open(const char *arg)
+{
+    (void)arg;
+
+    output_memory_ring = (output_event *)gptk_malloc(sizeof(output_event) * OUTPUT_MEMORY_EVENTS);
+    output_memory_head = 0;
+    output_memory_count = 0;
+
+    return true;
+}
+
+
+static ssize_t output_memory_write(int fd, const struct input_event *events, size_t count)
+{   // the oldest events are overwritten once the ring is full.
+    for (size_t i=0; i < count; i++)
+    {
+        size_t slot = (output_memory_head + output_memory_count) % OUTPUT_MEMORY_EVENTS;
+
+        output_memory_ring[slot].fd = fd;
+        output_memory_ring[slot].event = events[i];
+
+        if (output_memory_count < OUTPUT_MEMORY_EVENTS)
+            output_memory_count++;
+        else
+            output_memory_head = (output_memory_head + 1) % OUTPUT_MEMORY_EVENTS;
+    }
+
+    return (ssize_t)(sizeof(struct input_event) * count);
+}
+
+
+static void output_memory_close()
+{
+    free(output_memory_ring);
+
+    output_memory_ring = NULL;
+    output_memory_count = 0;
+}
+
+static const output_sink output_memory = {
+    .name = "memory",
+    .open = output_memory_open,
+    .write = output_memory_write,
+    .close = output_memory_close,
+};
+
+
+static FILE *output_file_fp = NULL;
+
+
+static bool output_file_open(const char *arg)
+{
+    if (arg == NULL || strlen(arg) == 0)
+    {
+        fprintf(stderr, "output: file needs a path, file:path\n");
+        return false;
+    }
+
+    output_file_fp = fopen(arg, "w");
+
+    if (output_file_fp == NULL)
+    {
+        fprintf(stderr, "output: unable to open %s: %s\n", arg, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+static const char *output_device_name(int fd)
+{
+    if (fd == kb_uinp_fd)
+        return "kb";
+
+    if (fd == xbox_uinp_fd)
+        return "xbox";
+
+    if (fd == abs_uinp_fd)
+        return "abs";
+
+    if (fd == rep_uinp_fd)
+        return "rep";
+
+    return "?";
+}
+
+
+static ssize_t output_file_write(int fd, const struct input_event *events, size_t count)
+{
+    const char *device = output_device_name(fd);
+
+    for (size_t i=0; i < count; i++)
+    {
+        const struct input_event *ev = &events[i];
+        const char *key_name;
+
+        switch (ev->type)
+        {
+        case EV_SYN:
+            fprintf(output_file_fp, "%s SYN %d %d\n", device, ev->code, ev->value);
+            break;
+
+        case EV_KEY:
+            key_name = find_keycode(ev->code);
+
+            if (key_name != NULL)
+                fprintf(output_file_fp, "%s KEY %s %d\n", device, key_name, ev->value);
+            else
+                fprintf(output_file_fp, "%s KEY %d %d\n", device, ev->code, ev->value);
+            break;
+
+        case EV_REL:
+            fprintf(output_file_fp, "%s REL %d %d\n", device, ev->code, ev->value);
+            break;
+
+        case EV_ABS:
+            fprintf(output_file_fp, "%s ABS %d %d\n", device, ev->code, ev->value);
+            break;
+
+        default:
+            fprintf(output_file_fp, "%s %d %d %d\n", device, ev->type, ev->code, ev->value);
+            break;
+        }
+    }
+
+    return (ssize_t)(sizeof(struct input_event) * count);
+}
+
+
+static void output_file_close()
+{
+    if (output_file_fp != NULL)
+        fclose(output_file_fp);
+
+    output_file_fp = NULL;
+}
+
+static const output_sink output_file = {
+    .name = "file",
+    .open = output_file_open,
+    .write = output_file_write,
+    .close = output_file_close,
+};
+
+
+static const output_sink *output_sinks[] = {
+    &output_uinput,
+    &output_null,
+    &output_memory,
+    &output_file,
+};
+
+static const output_sink *output_current = &output_uinput;
+static Uint64 output_frames = 0;
+static Uint64 output_events = 0;
+
+
+bool output_select(const char *spec)
+{   // spec is "name" or "name:argument", returns false if it can't be used.
+    const char *arg = strchr(spec, ':');
+    size_t name_len = (arg != NULL ? (size_t)(arg - spec) : strlen(spec));
+
+    if (arg != NULL)
+        arg++;
+
+    for (size_t i=0; i < sizeof(output_sinks) / sizeof(output_sinks[0]); i++)
+    {
+        const output_sink *sink = output_sinks[i];
+
+        if (strlen(sink->name) != name_len || strncasecmp(sink->name, spec, name_len) != 0)
+            continue;
+
+        if (sink->open != NULL && !sink->open(arg))
+            return false;
+
+        output_set_sink(sink);
+
+        if (!output_is_uinput())
+            printf("Output going to %s, not creating devices.\n", spec);
+
+        return true;
+    }
+
+    fprintf(stderr, "output: unknown output '%s', use uinput, null, memory or file:path\n", spec);
+    return false;
+}
+
+
+void output_set_sink(const output_sink *sink)
+{   // NULL goes back to uinput, the old sink isn't closed.
+    emit_flush_all();
+
+    output_current = (sink != NULL ? sink : &output_uinput);
+}
+
+
+bool output_is_uinput()
+{
+    return (output_current == &output_uinput);
+}
+
+
+ssize_t output_write(int fd, const struct input_event *events, size_t count)
+{
+    output_frames++;
+    output_events += count;
+
+    return output_current->write(fd, events, count);
+}
+
+
+size_t output_memory_read(output_event *events, size_t max)
+{   // take up to max of the oldest events from the memory output.
+    size_t count = 0;
+
+    while (count < max && output_memory_count > 0)
+    {
+        events[count++] = output_memory_ring[output_memory_head];
+
+        output_memory_head = (output_memory_head + 1) % OUTPUT_MEMORY_EVENTS;
+        output_memory_count--;
+    }
+
+    return count;
+}
+
+
+void output_quit()
+{
+    emit_flush_all();
+
+    if (!output_is_uinput())
+        printf("output: %" PRIu64 " frames, %" PRIu64 " events sent to %s\n",
+            output_frames, output_events, output_current->name);
+
+    if (output_current->close != NULL)
+        output_current->close();
+
+    output_current = &output_uinput;
+    output_frames = 0;
+    output_events = 0;
+}
@@ -0,0 +1,402 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <dirent.h>
+#include <signal.h>
+#include <sys/syscall.h>
+
+/* Finding and killing the game.
+ *
+ * We look through /proc ourselves instead of running ps/pkill, the pid we
+ * find is remembered so the next lookup only has to check it is still the
+ * same process. Where the kernel supports it the signal is sent through a
+ * pidfd, so the pid can't be reused between finding it and killing it.
+ *
+ * A process matches if its name is kill_process_name, in kill mode (-X) the
+ * file name of the program it is running is checked too. In pkill mode (the
+ * default) every match is killed like pkill -9 did, so helpers the game
+ * forked go too. Kill mode only kills the first match, like the old
+ * "ps | grep" and kill.
+ *
+ * With -w we also watch the process and quit once it exits. The pidfd is
+ * readable once the process is gone, so it just sits in the event loop
+ * with the controllers. Until the process shows up we look for it once a
+ * second.
+ */
+
+#define PROCESS_NAME_MAX 256
+#define PROCESS_KILL_MAX 32
+#define PROCESS_WATCH_SCAN_MS 1000
+
+bool process_watch_mode = false;
+
+static pid_t process_cached_pid = 0;
+static char process_cached_name[MAX_PROCESS_NAME] = "";
+
+static int process_watch_pidfd = -1;
+static pid_t process_watch_pid = 0;
+static char process_watch_name[MAX_PROCESS_NAME] = "";
+static Uint64 process_watch_next_scan = 0;
+
+
+static bool process_read_file(pid_t pid, const char *file, char *buffer, size_t buffer_size)
+{   // read /proc/<pid>/<file>, for cmdline the buffer holds argv[0].
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, file);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    ssize_t len = read(fd, buffer, buffer_size - 1);
+    close(fd);
+
+    if (len <= 0)
+        return false;
+
+    while (len > 0 && (buffer[len-1] == '\n' || buffer[len-1] == '\0'))
+        len--;
+
+    buffer[len] = '\0';
+    return true;
+}
+
+
+static bool process_matches(pid_t pid, const char *process_name, bool match_cmdline)
+{
+    char buffer[PROCESS_NAME_MAX];
+
+    if (process_read_file(pid, "stat", buffer, sizeof(buffer)))
+    {   // zombies have already exited, they're only waiting on their parent.
+        char *state = strrchr(buffer, ')');
+
+        if (state != NULL && state[1] == ' ' && state[2] == 'Z')
+            return false;
+    }
+
+    if (process_read_file(pid, "comm", buffer, sizeof(buffer)))
+    {
+        if (strcmp(buffer, process_name) == 0)
+            return true;
+
+        // comm is cut off at 15 characters.
+        if (strlen(buffer) == 15 && strncmp(buffer, process_name, 15) == 0)
+            return true;
+    }
+
+    if (match_cmdline && process_read_file(pid, "cmdline", buffer, sizeof(buffer)))
+    {
+        const char *program = strrchr(buffer, '/');
+
+        if (strcmp((program != NULL ? program + 1 : buffer), process_name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int process_scan(const char *process_name, bool match_cmdline, pid_t *pids, int pids_max)
+{   // find up to pids_max processes matching process_name, returns how many were found.
+    DIR *proc_dir = opendir("/proc");
+    struct dirent *entry;
+    pid_t self_pid = getpid();
+    int count = 0;
+
+    if (proc_dir == NULL)
+    {
+        fprintf(stderr, "process: unable to open /proc: %s\n", strerror(errno));
+        return 0;
+    }
+
+    while (count < pids_max && (entry = readdir(proc_dir)) != NULL)
+    {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+
+        pid_t pid = (pid_t)atoi(entry->d_name);
+
+        if (pid <= 0 || pid == self_pid)
+            continue;
+
+        if (process_matches(pid, process_name, match_cmdline))
+            pids[count++] = pid;
+    }
+
+    closedir(proc_dir);
+    return count;
+}
+
+
+pid_t process_find(const char *process_name)
+{   /* Find the pid of process_name, returns 0 if it isn't running.
+     *
+     * The last pid found is checked first, so this is cheap while the game is running.
+     */
+    if (strlen(process_name) == 0)
+        return 0;
+
+    if (process_cached_pid > 0 && strcmp(process_cached_name, process_name) == 0 &&
+        process_matches(process_cached_pid, process_name, want_kill))
+        return process_cached_pid;
+
+    pid_t pid = 0;
+
+    process_scan(process_name, want_kill, &pid, 1);
+
+    process_cached_pid = pid;
+    strncpy(process_cached_name, process_name, MAX_PROCESS_NAME - 1);
+
+    return pid;
+}
+
+
+int process_pidfd_open(pid_t pid)
+{   // returns -1 if pidfds aren't supported.
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+static bool process_signal(pid_t pid, const char *process_name)
+{   // kill a single process, returns false if we weren't allowed to.
+    int result = -1;
+    int pidfd = process_pidfd_open(pid);
+
+    if (pidfd >= 0)
+    {
+#ifdef SYS_pidfd_send_signal
+        // make sure the pid is still what we think it is now that we hold on to it.
+        if (!process_matches(pid, process_name, want_kill))
+        {
+            close(pidfd);
+            return true;
+        }
+
+        result = syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+#else
+        errno = ENOSYS;
+#endif
+        close(pidfd);
+    }
+
+    if (result < 0 && errno != EPERM && errno != ESRCH)
+        result = kill(pid, SIGKILL);
+
+    if (result == 0 || errno == ESRCH)
+    {
+        printf("Process with name '%s' and PID %d killed successfully.\n", process_name, (int)pid);
+        return true;
+    }
+
+    if (errno == EPERM && want_sudo)
+    {   // only now do we need sudo.
+        char command[64];
+
+        snprintf(command, sizeof(command), "sudo kill -9 %d", (int)pid);
+
+        if (system(command) == 0)
+        {
+            printf("Process with name '%s' and PID %d killed successfully.\n", process_name, (int)pid);
+            return true;
+        }
+    }
+
+    fprintf(stderr, "Unable to kill '%s' (%d): %s\n", process_name, (int)pid, strerror(errno));
+    return false;
+}
+
+
+void process_with_pc_quit()
+{
+    emitKey(kb_uinp_fd, KEY_F4, true, MOD_ALT);
+    SDL_Delay(15);
+
+    emitKey(kb_uinp_fd, KEY_F4, false, MOD_ALT);
+    SDL_Delay(15);
+}
+
+
+bool process_kill()
+{   /* Kill the processes matching kill_process_name, every one of them in
+     * pkill mode and just the first in kill mode.
+     *
+     * Returns true once they aren't running.
+     */
+    if (want_pc_quit)
+        process_with_pc_quit();
+
+    if (strlen(kill_process_name) == 0)
+        return false;
+
+    // the pid process_find cached is checked first, so this doesn't scan /proc.
+    pid_t pid = process_find(kill_process_name);
+    bool killed = true;
+
+    if (pid == 0)
+        printf("No process with name '%s' found.\n", kill_process_name);
+    else
+        killed = process_signal(pid, kill_process_name);
+
+    if (pid != 0 && !want_kill)
+    {   // anything else with the same name, like helpers the game forked.
+        pid_t pids[PROCESS_KILL_MAX];
+        int count = process_scan(kill_process_name, false, pids, PROCESS_KILL_MAX);
+
+        for (int i=0; i < count; i++)
+        {
+            if (pids[i] != pid && !process_signal(pids[i], kill_process_name))
+                killed = false;
+        }
+    }
+
+    process_cached_pid = 0;
+
+    return killed;
+}
+
+
+static void process_watch_stop()
+{
+    if (process_watch_pidfd >= 0)
+    {
+        event_unwatch_fd(process_watch_pidfd);
+        close(process_watch_pidfd);
+    }
+
+    process_watch_pidfd = -1;
+    process_watch_pid = 0;
+}
+
+
+static void process_watch_exited()
+{
+    printf("'%s' (%d) exited.\n", process_watch_name, (int)process_watch_pid);
+
+    process_watch_stop();
+    controllers_disable_exclusive();
+
+    if (daemon_mode)
+        daemon_target_quit();
+    else
+        current_state.running = false;
+}
+
+
+static void process_watch_ready(int fd, void *data)
+{   // the pidfd is readable, so the process has exited.
+    (void)fd;
+    (void)data;
+
+    if (process_watch_pidfd < 0)
+        return;
+
+    if (strcmp(process_watch_name, kill_process_name) != 0)
+    {   // we already dealt with it, see process_watch_update.
+        process_watch_stop();
+        return;
+    }
+
+    process_watch_exited();
+}
+
+
+void process_watch_update(Uint64 now)
+{
+    if (!process_watch_mode)
+        return;
+
+    if (strcmp(process_watch_name, kill_process_name) != 0)
+    {   // started, or the daemon was told to watch something else.
+        process_watch_stop();
+        strncpy(process_watch_name, kill_process_name, MAX_PROCESS_NAME - 1);
+        process_watch_next_scan = now;
+    }
+
+    if (strlen(process_watch_name) == 0 || process_watch_pidfd >= 0)
+        return;
+
+    if (now < process_watch_next_scan)
+        return;
+
+    process_watch_next_scan = now + MS_TO_NS(PROCESS_WATCH_SCAN_MS);
+
+    if (process_watch_pid > 0)
+    {   // no pidfd, check on it the slow way.
+        if (!process_matches(process_watch_pid, process_watch_name, want_kill))
+            process_watch_exited();
+
+        return;
+    }
+
+    pid_t pid = process_find(process_watch_name);
+
+    if (pid == 0)
+        return;
+
+    process_watch_pid = pid;
+
+    int pidfd = process_pidfd_open(pid);
+
+    if (pidfd >= 0 && event_watch_fd(pidfd, process_watch_ready, NULL))
+    {
+        process_watch_pidfd = pidfd;
+        printf("Found '%s' (%d), quitting when it exits.\n", process_watch_name, (int)pid);
+
+        // it might have gone before we got the pidfd.
+        if (!process_matches(pid, process_watch_name, want_kill))
+            process_watch_exited();
+    }
+    else
+    {
+        if (pidfd >= 0)
+            close(pidfd);
+
+        printf("Found '%s' (%d), checking on it every %dms.\n", process_watch_name, (int)pid, PROCESS_WATCH_SCAN_MS);
+    }
+}
+
+
+Sint64 process_watch_timeout(Uint64 now)
+{   // how many ns until process_watch_update needs to run again, -1 if it doesn't.
+    if (!process_watch_mode || strlen(kill_process_name) == 0)
+        return -1;
+
+    if (strcmp(process_watch_name, kill_process_name) != 0)
+        return 0;
+
+    if (process_watch_pidfd >= 0)
+        return -1;
+
+    return clock_until(process_watch_next_scan, now);
+}
+
+
+void process_watch_quit()
+{
+    process_watch_stop();
+    process_watch_name[0] = '\0';
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+
+/* Recording and loading controller event streams.
+ *
+ * With -R every controller button and axis event is appended to a file,
+ * gptokeyb2-bench can then replay it through the engine. Files are an
+ * 8 byte magic followed by fixed size records in native byte order, they
+ * are meant to be replayed on the machine they were recorded on.
+ */
+
+#define RECORD_MAGIC "GPTKREC1"
+#define RECORD_MAGIC_LEN 8
+
+static FILE *record_fp = NULL;
+static Uint32 record_start_ticks = 0;
+
+bool record_enabled = false;
+
+
+bool record_open(const char *file_name)
+{
+    record_fp = fopen(file_name, "wb");
+
+    if (record_fp == NULL)
+    {
+        fprintf(stderr, "record: unable to open %s: %s\n", file_name, strerror(errno));
+        return false;
+    }
+
+    if (fwrite(RECORD_MAGIC, RECORD_MAGIC_LEN, 1, record_fp) != 1)
+    {
+        fprintf(stderr, "record: unable to write %s: %s\n", file_name, strerror(errno));
+        fclose(record_fp);
+        record_fp = NULL;
+        return false;
+    }
+
+    record_start_ticks = SDL_GetTicks();
+    record_enabled = true;
+
+    printf("Recording events to %s\n", file_name);
+    return true;
+}
+
+
+void record_event(const SDL_Event *event)
+{
+    record_entry entry;
+
+    memset(&entry, 0, sizeof(entry));
+
+    switch (event->type)
+    {
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        entry.ticks = event->cbutton.timestamp - record_start_ticks;
+        entry.type = (event->type == SDL_CONTROLLERBUTTONDOWN ? RECORD_BUTTON_DOWN : RECORD_BUTTON_UP);
+        entry.index = event->cbutton.button;
+        break;
+
+    case SDL_CONTROLLERAXISMOTION:
+        entry.ticks = event->caxis.timestamp - record_start_ticks;
+        entry.type = RECORD_AXIS;
+        entry.index = event->caxis.axis;
+        entry.value = event->caxis.value;
+        break;
+
+    default:
+        return;
+    }
+
+    if (fwrite(&entry, sizeof(entry), 1, record_fp) != 1)
+    {
+        fprintf(stderr, "record: write failed, recording stopped: %s\n", strerror(errno));
+        record_close();
+    }
+}
+
+
+void record_close()
+{
+    if (record_fp != NULL)
+        fclose(record_fp);
+
+    record_fp = NULL;
+    record_enabled = false;
+}
+
+
+record_entry *record_load(const char *file_name, size_t *count)
+{   // load a whole recording, returns NULL if it isn't one.
+    FILE *fp = fopen(file_name, "rb");
+    char magic[RECORD_MAGIC_LEN];
+    record_entry *entries = NULL;
+    size_t entries_alloc = 0;
+
+    *count = 0;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "record: unable to open %s: %s\n", file_name, strerror(errno));
+        return NULL;
+    }
+
+    if (fread(magic, RECORD_MAGIC_LEN, 1, fp) != 1 || memcmp(magic, RECORD_MAGIC, RECORD_MAGIC_LEN) != 0)
+    {
+        fprintf(stderr, "record: %s is not a recording\n", file_name);
+        fclose(fp);
+        return NULL;
+    }
+
+    while (true)
+    {
+        if (*count >= entries_alloc)
+        {
+            size_t new_alloc = (entries_alloc == 0 ? 1024 : entries_alloc * 2);
+
+            entries = (record_entry *)gptk_realloc(entries,
+                sizeof(record_entry) * entries_alloc,
+                sizeof(record_entry) * new_alloc);
+            entries_alloc = new_alloc;
+        }
+
+        if (fread(&entries[*count], sizeof(record_entry), 1, fp) != 1)
+            break;
+
+        (*count)++;
+    }
+
+    fclose(fp);
+    return entries;
+}
+
+
+void record_to_event(const record_entry *entry, SDL_Event *event)
+{
+    memset(event, 0, sizeof(SDL_Event));
+
+    if (entry->type == RECORD_AXIS)
+    {
+        event->type = SDL_CONTROLLERAXISMOTION;
+        event->caxis.timestamp = entry->ticks;
+        event->caxis.axis = entry->index;
+        event->caxis.value = entry->value;
+    }
+    else
+    {
+        event->type = (entry->type == RECORD_BUTTON_DOWN ? SDL_CONTROLLERBUTTONDOWN : SDL_CONTROLLERBUTTONUP);
+        event->cbutton.timestamp = entry->ticks;
+        event->cbutton.button = entry->index;
+        event->cbutton.state = (entry->type == RECORD_BUTTON_DOWN ? 1 : 0);
+    }
+}
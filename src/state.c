@@ -37,6 +37,28 @@
 
 #include "gptokeyb2.h"
 
+// these live here rather than main.c so gptokeyb2-bench can link the engine.
+// ioctls prevent these from being on the same fd
+int xbox_uinp_fd = 0; // fake xbox controller
+int kb_uinp_fd = 0;  // fake relative mouse and keyboard
+int abs_uinp_fd = 0; // fake absolute position mouse
+int rep_uinp_fd = 0; // fake keyboard the kernel repeats keys on
+
+bool xbox360_mode=false;
+bool config_mode=false;
+
+bool want_pc_quit = false;
+bool want_kill = false;
+bool want_sudo = false;
+
+char user_config_file[MAX_PATH];
+
+char game_prefix[MAX_PROCESS_NAME] = "";
+char kill_process_name[MAX_PROCESS_NAME] = "";
+char default_control[MAX_CONTROL_NAME] = "";
+
+gptokeyb_config *default_config=NULL;
+
 gptokeyb_state current_state;
 bool current_dpad_as_mouse = false;
 bool current_left_analog_as_mouse = false;
@@ -56,15 +78,12 @@ typedef struct _controller_fd
 
 controller_fd *controller_fds = NULL;
 
+// effective layer, the resolved button for each gbtn.
+static const gptokeyb_button *state_buttons[GBTN_MAX];
 
-void state_init()
-{
-    memset((void*)&current_state, '\0', sizeof(gptokeyb_state));
-
-    set_hotkey(GBTN_BACK);
-
-    current_state.running = true;
 
+void state_config_defaults()
+{   // reset the settings that can be changed by a [config] section.
     current_state.repeat_delay = SDL_DEFAULT_REPEAT_DELAY;
     current_state.repeat_rate  = SDL_DEFAULT_REPEAT_INTERVAL;
 
@@ -72,15 +91,40 @@ void state_init()
     current_state.mouse_slow_scale = 50;
 
     current_state.deadzone_mode  = DZ_DEFAULT;
+    current_state.deadzone_math  = DZM_TABLE;
     current_state.deadzone_scale = 512;
 
     current_state.deadzone_x = 1000;
     current_state.deadzone_y = 1000;
     current_state.deadzone_triggers = 3000;
 
+    analog_curve_reset(&current_state.left_analog_curve);
+    analog_curve_reset(&current_state.right_analog_curve);
+
     current_state.dpad_mouse_normalize = true;
 
+    current_state.kernel_repeat = false;
+
     current_state.mouse_delay  = 16;
+    current_state.mouse_rate   = 0;
+
+    current_state.absolute_center_x = 0;
+    current_state.absolute_center_y = 0;
+    current_state.absolute_step     = 0;
+    current_state.absolute_deadzone = 0;
+    current_state.absolute_rotate   = 0;
+}
+
+
+void state_init()
+{
+    memset((void*)&current_state, '\0', sizeof(gptokeyb_state));
+
+    set_hotkey(GBTN_BACK);
+
+    current_state.running = true;
+
+    state_config_defaults();
 
     controller_fds = NULL;
 
@@ -292,6 +336,66 @@ void pop_state()
 }
 
 
+void state_release_all()
+{   /* Release every button that is held down, so no keys are left stuck, and
+     * drop any temporary states.
+     */
+    current_state.in_repeat = 0;
+    current_state.last_pressed = current_state.pressed;
+    timer_cancel_all();
+
+    for (int btn=0; btn < GBTN_MAX; btn++)
+    {
+        if (is_pressed(btn))
+            update_button(btn, false);
+    }
+
+    current_state.last_pressed = current_state.pressed;
+    current_state.mouse_slow = 0;
+    current_state.mouse_move = 0;
+    current_state.pop_held = 0;
+
+    input_typing_flush();
+}
+
+
+void state_reset()
+{   /* Back to how things were at startup, nothing held, the sticks centred
+     * and only the default control on the stack. gptokeyb2-bench does this
+     * between runs.
+     */
+    state_release_all();
+
+    for (int btn=0; btn < GBTN_MAX; btn++)
+    {
+        config_temp_stack[btn] = NULL;
+        config_temp_stack_order[btn] = 0;
+    }
+
+    config_temp_stack_order_id = 0;
+    gptokeyb_config_depth = 0;
+
+    if (default_config != NULL)
+        config_stack[0] = default_config;
+
+    current_state.current_left_analog_x = 0;
+    current_state.current_left_analog_y = 0;
+    current_state.current_right_analog_x = 0;
+    current_state.current_right_analog_y = 0;
+    current_state.current_l2 = 0;
+    current_state.current_r2 = 0;
+    current_state.mouse_analog_dirty = ANALOG_NONE;
+    current_state.mouse_relative_x = 0;
+    current_state.mouse_relative_y = 0;
+    current_state.mouse_remainder_x = 0;
+    current_state.mouse_remainder_y = 0;
+    current_state.mouse_absolute_x = 0;
+    current_state.mouse_absolute_y = 0;
+
+    state_change_update();
+}
+
+
 bool is_pressed(int btn)
 {   // returns tree if button is down
     if (btn < 0 || btn > GBTN_MAX)
@@ -317,11 +421,45 @@ bool was_released(int btn)
 }
 
 Uint32 held_for(int btn)
-{
+{   // in ms
     if (!is_pressed(btn))
         return 0;
 
-    return (SDL_GetTicks() - current_state.held_since[btn]);
+    return (Uint32)NS_TO_MS(clock_now() - current_state.held_since[btn]);
+}
+
+
+static void state_repeat(int timer, Uint64 now);
+
+
+static void state_repeat_start(int btn, const gptokeyb_button *button, Uint64 now)
+{   /* Keys on the repeat keyboard are left held for the kernel to repeat if
+     * kernel_repeat is on, the mouse wheel and anything else gets a timer.
+     */
+    current_state.in_repeat |= (1<<btn);
+
+    if (keyboard_key_fd(button) != kb_uinp_fd)
+        return;
+
+    timer_set(TIMER_REPEAT + btn, now + MS_TO_NS(current_state.repeat_delay), state_repeat);
+}
+
+
+static void state_repeat(int timer, Uint64 now)
+{   // the button is still held, press it again.
+    int btn = timer - TIMER_REPEAT;
+
+    GPTK2_STAT(repeats);
+
+    // release button
+    update_button(btn, false);
+
+    // press button
+    current_state.in_repeat    |=  (1<<btn);
+    current_state.last_pressed &= ~(1<<btn);
+    update_button(btn, true);
+
+    timer_set(timer, now + MS_TO_NS(current_state.repeat_rate), state_repeat);
 }
 
 
@@ -330,53 +468,76 @@ void state_update()
      *
      * This handles things like START + SELECT to quit, button repeating.
      */
-    Uint32 current_ticks = SDL_GetTicks();
+    Uint64 now = clock_now();
 
     if (is_pressed(GBTN_START) && is_pressed(current_state.hotkey_gbtn))
     {
         if (process_kill())
-            current_state.running = false;
+        {
+            if (daemon_mode)
+                daemon_target_quit();
+            else
+                current_state.running = false;
+        }
     }
 
     current_state.last_pressed = current_state.pressed;
 
-    for (int btn=0; btn < GBTN_MAX; btn++)
+    timer_run(now);
+
+    // We don't need to rest absolute values only relative movement
+    if (!current_left_analog_as_mouse && !current_right_analog_as_mouse)
     {
-        if ((current_state.in_repeat & (1<<btn)) == 0)
-            continue;
+        current_state.mouse_relative_x = 0;
+        current_state.mouse_relative_y = 0;
+    }
+}
 
-        if (!is_pressed(btn))
-            continue;
 
-        if (!SDL_TICKS_PASSED(current_ticks, current_state.next_repeat[btn]))
+static int state_layers(gptokeyb_config **layers)
+{   /* Flatten the temp stack and config stack into a list of layers, from
+     * the top most to the bottom, returns the number of layers.
+     */
+    int layer_count = 0;
+    int temp_btns[GBTN_MAX];
+    int temp_count = 0;
+
+    // temp states, newest first.
+    for (int sbtn=0; sbtn < GBTN_MAX; sbtn++)
+    {
+        if (config_temp_stack[sbtn] == NULL)
             continue;
 
-        // release button
-        update_button(btn, false);
+        int i = temp_count++;
 
-        // press button
-        current_state.in_repeat    |=  (1<<btn);
-        current_state.last_pressed &= ~(1<<btn);
-        update_button(btn, true);
+        while (i > 0 && config_temp_stack_order[temp_btns[i-1]] < config_temp_stack_order[sbtn])
+        {
+            temp_btns[i] = temp_btns[i-1];
+            i--;
+        }
 
-        current_state.next_repeat[btn] = (current_ticks + current_state.repeat_rate);
+        temp_btns[i] = sbtn;
     }
 
-    // We don't need to rest absolute values only relative movement
-    if (!current_left_analog_as_mouse && !current_right_analog_as_mouse)
-    {
-        current_state.mouse_relative_x = 0;
-        current_state.mouse_relative_y = 0;
-    }
+    for (int i=0; i < temp_count; i++)
+        layers[layer_count++] = config_temp_stack[temp_btns[i]];
+
+    for (int current_depth = gptokeyb_config_depth; current_depth >= 0; current_depth--)
+        layers[layer_count++] = config_stack[current_depth];
+
+    return layer_count;
 }
 
 
 void state_change_update()
-{   // check as mouse_move and input set stuff.
-
-    #define NOT_FOUND_DPADS (!found_dpad_as_mouse || !found_left_analog_as_mouse || !found_right_analog_as_mouse || !found_left_analog_as_absolute_mouse || !found_right_analog_as_mouse)
+{   /* Resolve the current layers into the effective layer.
+     *
+     * This is only done when the state changes, so resolving a button press is just an array lookup.
+     */
+    GPTK2_STAT(state_change_update);
 
-    #define NOT_FOUND_INPUT_SETS ((found_charset == NULL) && (found_wordset == NULL))
+    gptokeyb_config *layers[GBTN_MAX + CFG_STACK_MAX];
+    int layer_count = state_layers(layers);
 
     bool found_dpad_as_mouse = false;
     bool found_left_analog_as_mouse = false;
@@ -384,87 +545,26 @@ void state_change_update()
     bool found_left_analog_as_absolute_mouse = false;
     bool found_right_analog_as_absolute_mouse = false;
     bool found_mouse_wheel_amount = false;
+    bool found_input_sets = false;
 
     int change_exclusive_mode = EXL_PARENT;
 
     const char *found_charset = NULL;
     const char *found_wordset = NULL;
 
-    // check temp stacks
-    int order_id = config_temp_stack_order_id;
-    while (order_id > 0)
-    {
-        for (int sbtn=0; sbtn < GBTN_MAX; sbtn++)
-        {
-            if (config_temp_stack[sbtn] == NULL)
-                continue;
-
-            if (config_temp_stack_order[sbtn] != order_id)
-                continue;
-
-            gptokeyb_config *current = config_temp_stack[sbtn];
-
-            if (change_exclusive_mode == EXL_PARENT && current->exclusive_mode != EXL_PARENT)
-            {
-                change_exclusive_mode = current->exclusive_mode;
-            }
-
-            if (!found_mouse_wheel_amount && current->mouse_wheel_amount > 0)
-            {
-                found_mouse_wheel_amount = true;
-                current_mouse_wheel_amount = current->mouse_wheel_amount;
-            }
-
-            if (NOT_FOUND_INPUT_SETS)
-            {
-                found_charset = current->charset;
-                found_wordset = current->wordset;
-            }
-
-            if (NOT_FOUND_DPADS)
-            {
-                // relative positioning
-                if (!found_dpad_as_mouse && current->dpad_as_mouse != MOUSE_MOVEMENT_PARENT)
-                {
-                    current_dpad_as_mouse = (current->dpad_as_mouse == MOUSE_MOVEMENT_ON);
-                    found_dpad_as_mouse = true;
-                }
-
-                if (!found_left_analog_as_mouse && current->left_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
-                {
-                    current_left_analog_as_mouse = (current->left_analog_as_mouse == MOUSE_MOVEMENT_ON);
-                    found_left_analog_as_mouse = true;
-                }
-
-                if (!found_right_analog_as_mouse && current->right_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
-                {
-                    current_right_analog_as_mouse = (current->right_analog_as_mouse == MOUSE_MOVEMENT_ON);
-                    found_right_analog_as_mouse = true;
-                }
+    for (int btn=0; btn < GBTN_MAX; btn++)
+        state_buttons[btn] = NULL;
 
-                if (!found_left_analog_as_absolute_mouse && current->left_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
-                {
-                    current_left_analog_as_absolute_mouse = (current->left_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
-                    found_left_analog_as_absolute_mouse = true;
-                }
+    for (int layer=0; layer < layer_count; layer++)
+    {
+        gptokeyb_config *current = layers[layer];
 
-                if (!found_right_analog_as_absolute_mouse && current->right_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
-                {
-                    current_right_analog_as_absolute_mouse = (current->right_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
-                    found_right_analog_as_absolute_mouse = true;
-                }
-            }
+        for (int btn=0; btn < GBTN_MAX; btn++)
+        {
+            if (state_buttons[btn] == NULL && current->button[btn].action != ACT_PARENT)
+                state_buttons[btn] = &current->button[btn];
         }
 
-        order_id--;
-    }
-
-    int current_depth = gptokeyb_config_depth;
-
-    while (current_depth >= 0)
-    {
-        gptokeyb_config *current = config_stack[current_depth];
-
         if (change_exclusive_mode == EXL_PARENT && current->exclusive_mode != EXL_PARENT)
         {
             change_exclusive_mode = current->exclusive_mode;
@@ -476,47 +576,43 @@ void state_change_update()
             current_mouse_wheel_amount = current->mouse_wheel_amount;
         }
 
-        if (NOT_FOUND_INPUT_SETS)
+        if (!found_input_sets)
         {
             found_charset = current->charset;
             found_wordset = current->wordset;
+            found_input_sets = (found_charset != NULL || found_wordset != NULL);
         }
 
-        if (NOT_FOUND_DPADS)
+        // relative positioning
+        if (!found_dpad_as_mouse && current->dpad_as_mouse != MOUSE_MOVEMENT_PARENT)
         {
-            // relative positioning
-            if (!found_dpad_as_mouse && current->dpad_as_mouse != MOUSE_MOVEMENT_PARENT)
-            {
-                current_dpad_as_mouse = (current->dpad_as_mouse == MOUSE_MOVEMENT_ON);
-                found_dpad_as_mouse = true;
-            }
-
-            if (!found_left_analog_as_mouse && current->left_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
-            {
-                current_left_analog_as_mouse = (current->left_analog_as_mouse == MOUSE_MOVEMENT_ON);
-                found_left_analog_as_mouse = true;
-            }
+            current_dpad_as_mouse = (current->dpad_as_mouse == MOUSE_MOVEMENT_ON);
+            found_dpad_as_mouse = true;
+        }
 
-            if (!found_right_analog_as_mouse && current->right_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
-            {
-                current_right_analog_as_mouse = (current->right_analog_as_mouse == MOUSE_MOVEMENT_ON);
-                found_right_analog_as_mouse = true;
-            }
+        if (!found_left_analog_as_mouse && current->left_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
+        {
+            current_left_analog_as_mouse = (current->left_analog_as_mouse == MOUSE_MOVEMENT_ON);
+            found_left_analog_as_mouse = true;
+        }
 
-            if (!found_left_analog_as_absolute_mouse && current->left_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
-            {
-                current_left_analog_as_absolute_mouse = (current->left_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
-                found_left_analog_as_absolute_mouse = true;
-            }
+        if (!found_right_analog_as_mouse && current->right_analog_as_mouse != MOUSE_MOVEMENT_PARENT)
+        {
+            current_right_analog_as_mouse = (current->right_analog_as_mouse == MOUSE_MOVEMENT_ON);
+            found_right_analog_as_mouse = true;
+        }
 
-            if (!found_right_analog_as_absolute_mouse && current->right_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
-            {
-                current_right_analog_as_absolute_mouse = (current->right_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
-                found_right_analog_as_absolute_mouse = true;
-            }
+        if (!found_left_analog_as_absolute_mouse && current->left_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
+        {
+            current_left_analog_as_absolute_mouse = (current->left_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
+            found_left_analog_as_absolute_mouse = true;
         }
 
-        current_depth--;
+        if (!found_right_analog_as_absolute_mouse && current->right_analog_as_absolute_mouse != MOUSE_MOVEMENT_PARENT)
+        {
+            current_right_analog_as_absolute_mouse = (current->right_analog_as_absolute_mouse == MOUSE_MOVEMENT_ON);
+            found_right_analog_as_absolute_mouse = true;
+        }
     }
 
     if (found_charset)
@@ -559,62 +655,22 @@ void state_change_update()
 
 
 const gptokeyb_button *state_button(int btn)
-{   // resolve a button through parent states.
-    gptokeyb_button *button;
-
-    // check temp states
-    int order_id = config_temp_stack_order_id;
-    while (order_id > 0)
-    {
-        for (int sbtn=0; sbtn < GBTN_MAX; sbtn++)
-        {
-            if (config_temp_stack[sbtn] == NULL)
-                continue;
-
-            if (config_temp_stack_order[sbtn] != order_id)
-                continue;
-
-            gptokeyb_config *current = config_temp_stack[sbtn];
-
-            if (current->button[btn].action == ACT_PARENT)
-                continue;
-
-            GPTK2_DEBUG("found temp[%s] -> %s\n", gbtn_names[sbtn], gbtn_names[btn]);
-
-            return &current->button[btn];
-        }
-
-        order_id--;
-    }
-
-    // check stack
-    int current_depth = gptokeyb_config_depth;
-
-    while (current_depth >= 0)
-    {
-        gptokeyb_config *config = config_stack[current_depth];
-
-        button = &config->button[btn];
-
-        if (button->action != ACT_PARENT)
-        {
-            GPTK2_DEBUG("found stack[%d] -> %s\n", current_depth, gbtn_names[btn]);
-            return button;
-        }
-
-        current_depth--;
-    }
-
-    return NULL;
+{   // resolve a button through parent states, see state_change_update.
+    return state_buttons[btn];
 }
 
 
 void update_button(int btn, bool pressed)
 {
     Uint32 btn_mask = (1<<btn);
-    Uint32 current_ticks = SDL_GetTicks();
+    Uint64 now = clock_now();
     const gptokeyb_button *button;
 
+    GPTK2_STAT(update_button);
+
+    if (trace_enabled)
+        trace_resolve();
+
     if (pressed)
         current_state.pressed |=  btn_mask;
     else
@@ -626,7 +682,7 @@ void update_button(int btn, bool pressed)
 
         if ((current_state.in_repeat & btn_mask) != 0)
         {   // if we're in repeat we get the held button.
-            current_state.held_since[btn] = current_ticks;
+            current_state.held_since[btn] = now;
             button = current_state.button_held[btn];
         }
         else
@@ -665,13 +721,10 @@ void update_button(int btn, bool pressed)
             if (button->keycode != 0)
             {
                 GPTK2_DEBUG("PRESSED '%s' -> '%s'\n", gbtn_names[btn], find_keycode(button->keycode));
-                emitKey(kb_uinp_fd, button->keycode, true, button->modifier);
+                emitKey(keyboard_key_fd(button), button->keycode, true, button->modifier);
 
                 if (button->repeat && !(current_state.in_repeat & btn_mask))
-                {
-                    current_state.in_repeat |= btn_mask;
-                    current_state.next_repeat[btn] = (current_ticks + current_state.repeat_delay);
-                }
+                    state_repeat_start(btn, button, now);
             }
         }
         else if (button->action == ACT_SPECIAL && button->special == SPC_MOUSE_SLOW)
@@ -748,14 +801,13 @@ void update_button(int btn, bool pressed)
         }
         else if (button->repeat && !(current_state.in_repeat & btn_mask))
         {
-            current_state.in_repeat |= btn_mask;
-            current_state.next_repeat[btn] = (current_ticks + current_state.repeat_delay);
+            state_repeat_start(btn, button, now);
         }
 
         if (button->keycode != 0)
         {
             GPTK2_DEBUG("PRESSED '%s' -> '%s'\n", gbtn_names[btn], find_keycode(button->keycode));
-            emitKey(kb_uinp_fd, button->keycode, true, button->modifier);
+            emitKey(keyboard_key_fd(button), button->keycode, true, button->modifier);
         }
     }
     else if (was_released(btn))
@@ -781,11 +833,12 @@ void update_button(int btn, bool pressed)
         current_state.mouse_slow &= ~btn_mask;
         current_state.mouse_move &= ~btn_mask;
         current_state.in_repeat  &= ~btn_mask;
+        timer_cancel(TIMER_REPEAT + btn);
 
         if (button->keycode != 0)
         {
             GPTK2_DEBUG("RELEASE '%s' -> '%s'\n", gbtn_names[btn], find_keycode(button->keycode));
-            emitKey(kb_uinp_fd, button->keycode, false, button->modifier);
+            emitKey(keyboard_key_fd(button), button->keycode, false, button->modifier);
         }
     }
 }
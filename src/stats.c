@@ -0,0 +1,177 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <signal.h>
+
+/* Hot path counters, built with -DGPTK2_STATS=ON.
+ *
+ * Without it the GPTK2_STAT macros expand to nothing and this file only
+ * has empty stubs. With it the counters are printed on SIGUSR2, and also
+ * written to $GPTK2_STATS_FILE if that is set.
+ */
+
+#ifdef GPTK2_STATS_ENABLED
+
+gptk_stats_counters gptk_stats;
+
+static const char *stats_device_names[STATS_DEVICES] = {
+    "kb",
+    "xbox",
+    "abs",
+};
+
+static int stats_signal_fd = -1;
+static Uint32 stats_start_ticks = 0;
+static Uint32 stats_last_ticks = 0;
+static Uint64 stats_last_wakeups = 0;
+
+
+void stats_write(int fd, size_t bytes)
+{
+    int device;
+
+    if (fd == kb_uinp_fd || fd == rep_uinp_fd)
+        device = STATS_DEVICE_KB;
+    else if (fd == xbox_uinp_fd)
+        device = STATS_DEVICE_XBOX;
+    else if (fd == abs_uinp_fd)
+        device = STATS_DEVICE_ABS;
+    else
+        return;
+
+    gptk_stats.uinput_writes[device]++;
+    gptk_stats.uinput_bytes[device] += bytes;
+}
+
+
+static void stats_print(FILE *fp)
+{
+    Uint32 current_ticks = SDL_GetTicks();
+    Uint32 uptime = current_ticks - stats_start_ticks;
+    Uint32 interval = current_ticks - stats_last_ticks;
+    Uint64 interval_wakeups = gptk_stats.wakeups - stats_last_wakeups;
+
+    fprintf(fp, "stats: uptime %ums\n", (unsigned)uptime);
+    fprintf(fp, "stats: events button %" PRIu64 " axis %" PRIu64 " device %" PRIu64 " watch %" PRIu64 " other %" PRIu64 "\n",
+        gptk_stats.events_button, gptk_stats.events_axis, gptk_stats.events_device,
+        gptk_stats.events_watch, gptk_stats.events_other);
+    fprintf(fp, "stats: update_button %" PRIu64 " state_change_update %" PRIu64 " repeats %" PRIu64 "\n",
+        gptk_stats.update_button, gptk_stats.state_change_update, gptk_stats.repeats);
+    fprintf(fp, "stats: mouse ticks moving %" PRIu64 " idle %" PRIu64 " deadzone calcs %" PRIu64 "\n",
+        gptk_stats.mouse_ticks_moving, gptk_stats.mouse_ticks_idle, gptk_stats.mouse_deadzone_calcs);
+
+    for (int device=0; device < STATS_DEVICES; device++)
+    {
+        if (gptk_stats.uinput_writes[device] == 0)
+            continue;
+
+        fprintf(fp, "stats: uinput %s writes %" PRIu64 " bytes %" PRIu64 "\n",
+            stats_device_names[device], gptk_stats.uinput_writes[device], gptk_stats.uinput_bytes[device]);
+    }
+
+    fprintf(fp, "stats: wakeups %" PRIu64 ", %.1f/s overall, %.1f/s since last dump\n",
+        gptk_stats.wakeups,
+        (uptime > 0 ? gptk_stats.wakeups * 1000.0 / uptime : 0.0),
+        (interval > 0 ? interval_wakeups * 1000.0 / interval : 0.0));
+
+    stats_last_ticks = current_ticks;
+    stats_last_wakeups = gptk_stats.wakeups;
+}
+
+
+void stats_dump()
+{
+    const char *stats_file = SDL_getenv("GPTK2_STATS_FILE");
+
+    if (stats_file != NULL && strlen(stats_file) > 0)
+    {
+        FILE *fp = fopen(stats_file, "w");
+
+        if (fp == NULL)
+        {
+            fprintf(stderr, "stats: unable to write %s: %s\n", stats_file, strerror(errno));
+        }
+        else
+        {
+            stats_print(fp);
+            fclose(fp);
+            return;
+        }
+    }
+
+    stats_print(stdout);
+    fflush(stdout);
+}
+
+
+static void stats_signal(int fd, void *data)
+{
+    (void)data;
+
+    if (signal_fd_read(fd) > 0)
+        stats_dump();
+}
+
+
+void stats_init()
+{   // needs to be called before SDL starts any threads, see signal_fd_open.
+    memset(&gptk_stats, 0, sizeof(gptk_stats));
+
+    stats_signal_fd = signal_fd_open(SIGUSR2);
+}
+
+
+void stats_start()
+{
+    stats_start_ticks = stats_last_ticks = SDL_GetTicks();
+
+    if (stats_signal_fd >= 0)
+        event_watch_fd(stats_signal_fd, stats_signal, NULL);
+}
+
+
+void stats_quit()
+{
+    if (stats_signal_fd >= 0)
+    {
+        event_unwatch_fd(stats_signal_fd);
+        close(stats_signal_fd);
+    }
+
+    stats_signal_fd = -1;
+}
+
+#else
+
+void stats_init()
+{
+}
+
+
+void stats_start()
+{
+}
+
+
+void stats_quit()
+{
+}
+
+#endif
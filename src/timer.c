@@ -0,0 +1,183 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+
+/* Timers, kept in a binary min-heap ordered by deadline.
+ *
+ * Every timer has a fixed id, see TIMER_* in gptokeyb2.h, so setting one
+ * that is already pending just moves it. timer_run only looks at the top
+ * of the heap, so a wakeup costs nothing for timers that aren't due, and
+ * timer_timeout tells the main loop how long it can sleep.
+ *
+ * Timers due at the same time run in id order.
+ */
+
+typedef struct
+{
+    Uint64 deadline;
+    int timer;
+} timer_entry;
+
+static timer_entry timer_heap[TIMER_COUNT];
+static int timer_heap_size = 0;
+
+// position in the heap + 1, 0 if the timer isn't pending.
+static int timer_position[TIMER_COUNT];
+static timer_func timer_funcs[TIMER_COUNT];
+
+
+static bool timer_before(const timer_entry *a, const timer_entry *b)
+{
+    if (a->deadline != b->deadline)
+        return (a->deadline < b->deadline);
+
+    return (a->timer < b->timer);
+}
+
+
+static void timer_place(int index, timer_entry entry)
+{
+    timer_heap[index] = entry;
+    timer_position[entry.timer] = index + 1;
+}
+
+
+static void timer_sift_up(int index)
+{
+    timer_entry entry = timer_heap[index];
+
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+
+        if (!timer_before(&entry, &timer_heap[parent]))
+            break;
+
+        timer_place(index, timer_heap[parent]);
+        index = parent;
+    }
+
+    timer_place(index, entry);
+}
+
+
+static void timer_sift_down(int index)
+{
+    timer_entry entry = timer_heap[index];
+
+    while (true)
+    {
+        int child = index * 2 + 1;
+
+        if (child >= timer_heap_size)
+            break;
+
+        if (child + 1 < timer_heap_size && timer_before(&timer_heap[child + 1], &timer_heap[child]))
+            child++;
+
+        if (!timer_before(&timer_heap[child], &entry))
+            break;
+
+        timer_place(index, timer_heap[child]);
+        index = child;
+    }
+
+    timer_place(index, entry);
+}
+
+
+static void timer_remove_at(int index)
+{
+    timer_position[timer_heap[index].timer] = 0;
+    timer_heap_size--;
+
+    if (index == timer_heap_size)
+        return;
+
+    timer_place(index, timer_heap[timer_heap_size]);
+    timer_sift_down(index);
+    timer_sift_up(timer_position[timer_heap[index].timer] - 1);
+}
+
+
+void timer_set(int timer, Uint64 deadline, timer_func func)
+{   // start the timer, or move it if it is already pending.
+    timer_entry entry = {.deadline = deadline, .timer = timer};
+
+    timer_funcs[timer] = func;
+
+    if (timer_position[timer] != 0)
+    {
+        int index = timer_position[timer] - 1;
+
+        timer_place(index, entry);
+        timer_sift_down(index);
+        timer_sift_up(timer_position[timer] - 1);
+        return;
+    }
+
+    timer_place(timer_heap_size++, entry);
+    timer_sift_up(timer_heap_size - 1);
+}
+
+
+void timer_cancel(int timer)
+{
+    if (timer_position[timer] != 0)
+        timer_remove_at(timer_position[timer] - 1);
+}
+
+
+void timer_cancel_all()
+{
+    for (int i=0; i < timer_heap_size; i++)
+        timer_position[timer_heap[i].timer] = 0;
+
+    timer_heap_size = 0;
+}
+
+
+bool timer_pending(int timer)
+{
+    return (timer_position[timer] != 0);
+}
+
+
+void timer_run(Uint64 now)
+{   /* Run every timer that is due. A timer is taken off before it runs, so
+     * it can set itself again.
+     */
+    while (timer_heap_size > 0 && timer_heap[0].deadline <= now)
+    {
+        int timer = timer_heap[0].timer;
+
+        timer_remove_at(0);
+        timer_funcs[timer](timer, now);
+    }
+}
+
+
+Sint64 timer_timeout(Uint64 now)
+{   // how many ns until the next timer is due, -1 if there are none.
+    if (timer_heap_size == 0)
+        return -1;
+
+    return clock_until(timer_heap[0].deadline, now);
+}
@@ -0,0 +1,249 @@
+/* Copyright (c) 2021-2024
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+#
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+#
+* You should have received a copy of the GNU General Public
+* License along with this program; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+* Boston, MA 02110-1301 USA
+*/
+
+
+#include "gptokeyb2.h"
+#include <signal.h>
+
+/* Latency tracing, enabled with GPTK2_TRACE=1.
+ *
+ * Controller events are timestamped when they arrive in handleInputEvent,
+ * when update_button resolves them, and when the resulting uinput frame is
+ * written. The time between those points goes into log bucketed
+ * histograms, which are printed on SIGUSR1 and at exit.
+ *
+ * Ingress is measured from the kernel event timestamp in evdev mode and
+ * from the SDL event timestamp (only ms precision) otherwise.
+ *
+ * Everything happens on the main thread, the signal arrives through a
+ * signalfd in the event loop, so nothing here needs locking.
+ */
+
+// each power of two is split into 8 buckets, so percentiles are within 12.5%.
+#define TRACE_SUB_BITS 3
+#define TRACE_SUB_COUNT (1 << TRACE_SUB_BITS)
+#define TRACE_BUCKETS (64 << TRACE_SUB_BITS)
+
+enum
+{
+    TRACE_INGRESS,
+    TRACE_RESOLVE,
+    TRACE_WRITE_KB,
+    TRACE_WRITE_XBOX,
+    TRACE_WRITE_ABS,
+    TRACE_STAGES,
+};
+
+typedef struct
+{
+    const char *name;
+    Uint64 count;
+    Uint64 max;
+    Uint32 buckets[TRACE_BUCKETS];
+} trace_histogram;
+
+bool trace_enabled = false;
+
+static trace_histogram trace_histograms[TRACE_STAGES] = {
+    {.name = "ingress"},
+    {.name = "resolve"},
+    {.name = "write kb"},
+    {.name = "write xbox"},
+    {.name = "write abs"},
+};
+
+static int trace_signal_fd = -1;
+static Uint64 trace_source_ns = 0;
+static Uint64 trace_event_ns = 0;
+
+
+static int trace_bucket(Uint64 value)
+{
+    if (value < TRACE_SUB_COUNT)
+        return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - TRACE_SUB_BITS;
+
+    return ((shift + 1) << TRACE_SUB_BITS) + (int)((value >> shift) & (TRACE_SUB_COUNT - 1));
+}
+
+
+static Uint64 trace_bucket_limit(int bucket)
+{   // the largest value that lands in this bucket.
+    if (bucket < TRACE_SUB_COUNT)
+        return (Uint64)bucket;
+
+    int shift = (bucket >> TRACE_SUB_BITS) - 1;
+    Uint64 low = (Uint64)(TRACE_SUB_COUNT + (bucket & (TRACE_SUB_COUNT - 1))) << shift;
+
+    return low + ((1ULL << shift) - 1);
+}
+
+
+static void trace_record(int stage, Uint64 ns)
+{
+    trace_histogram *histogram = &trace_histograms[stage];
+
+    histogram->buckets[trace_bucket(ns)]++;
+    histogram->count++;
+
+    if (ns > histogram->max)
+        histogram->max = ns;
+}
+
+
+static Uint64 trace_percentile(const trace_histogram *histogram, int percent)
+{
+    Uint64 target = (histogram->count * percent + 99) / 100;
+    Uint64 seen = 0;
+
+    for (int i=0; i < TRACE_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+
+        if (seen >= target)
+        {
+            Uint64 limit = trace_bucket_limit(i);
+
+            return (limit < histogram->max ? limit : histogram->max);
+        }
+    }
+
+    return histogram->max;
+}
+
+
+void trace_dump()
+{
+    printf("trace: %-10s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us");
+
+    for (int stage=0; stage < TRACE_STAGES; stage++)
+    {
+        const trace_histogram *histogram = &trace_histograms[stage];
+
+        if (histogram->count == 0)
+            continue;
+
+        printf("trace: %-10s %10" PRIu64 " %10.1f %10.1f %10.1f\n",
+            histogram->name,
+            histogram->count,
+            trace_percentile(histogram, 50) / 1000.0,
+            trace_percentile(histogram, 99) / 1000.0,
+            histogram->max / 1000.0);
+    }
+
+    fflush(stdout);
+}
+
+
+static void trace_signal(int fd, void *data)
+{
+    (void)data;
+
+    if (signal_fd_read(fd) > 0)
+        trace_dump();
+}
+
+
+void trace_init()
+{   // needs to be called before SDL starts any threads, see signal_fd_open.
+    const char *env_trace = SDL_getenv("GPTK2_TRACE");
+
+    if (env_trace == NULL || strcmp(env_trace, "1") != 0)
+        return;
+
+    trace_enabled = true;
+    trace_signal_fd = signal_fd_open(SIGUSR1);
+
+    printf("Tracing latency, send SIGUSR1 to print it.\n");
+}
+
+
+void trace_start()
+{
+    if (trace_signal_fd >= 0)
+        event_watch_fd(trace_signal_fd, trace_signal, NULL);
+}
+
+
+void trace_quit()
+{
+    if (!trace_enabled)
+        return;
+
+    trace_dump();
+
+    if (trace_signal_fd >= 0)
+    {
+        event_unwatch_fd(trace_signal_fd);
+        close(trace_signal_fd);
+    }
+
+    trace_signal_fd = -1;
+    trace_enabled = false;
+}
+
+
+void trace_source(const struct timeval *time)
+{   // the kernel timestamp of the evdev event behind the next event.
+    trace_source_ns = (Uint64)time->tv_sec * NS_PER_SEC + (Uint64)time->tv_usec * 1000ULL;
+}
+
+
+void trace_ingress(const SDL_Event *event)
+{
+    Uint64 now = clock_monotonic_ns();
+
+    if (trace_source_ns != 0 && trace_source_ns <= now)
+        trace_record(TRACE_INGRESS, now - trace_source_ns);
+    else if (trace_source_ns == 0)
+        trace_record(TRACE_INGRESS, MS_TO_NS(SDL_GetTicks() - event->common.timestamp));
+
+    trace_source_ns = 0;
+    trace_event_ns = now;
+}
+
+
+void trace_resolve()
+{
+    if (trace_event_ns != 0)
+        trace_record(TRACE_RESOLVE, clock_monotonic_ns() - trace_event_ns);
+}
+
+
+void trace_write(int fd)
+{
+    if (trace_event_ns == 0)
+        return;
+
+    Uint64 elapsed = clock_monotonic_ns() - trace_event_ns;
+
+    if (fd == kb_uinp_fd || fd == rep_uinp_fd)
+        trace_record(TRACE_WRITE_KB, elapsed);
+    else if (fd == xbox_uinp_fd)
+        trace_record(TRACE_WRITE_XBOX, elapsed);
+    else if (fd == abs_uinp_fd)
+        trace_record(TRACE_WRITE_ABS, elapsed);
+}
+
+
+void trace_done()
+{   // anything written after this isn't caused by the event.
+    trace_event_ns = 0;
+}
@@ -36,15 +36,37 @@
 */
 
 #include "gptokeyb2.h"
+#include <signal.h>
+#include <sys/signalfd.h>
 
-typedef struct _string_reg
+#define STRING_ARENA_SIZE 4096
+#define STRING_TABLE_MIN  256
+
+typedef struct _string_arena
+{
+    struct _string_arena *next;
+    size_t size;
+    size_t used;
+    char data[];
+} string_arena;
+
+typedef struct
 {
-    struct _string_reg *next;
+    const char *string;
+    Uint32 hash;
     int counter;
-    char *string;
 } string_reg;
 
-static string_reg *root_string = NULL;
+static string_arena *string_arenas = NULL;
+
+// open addressed, always a power of 2 in size.
+static string_reg *string_table = NULL;
+static size_t string_table_size = 0;
+static size_t string_table_used = 0;
+
+static size_t string_bytes = 0;
+static size_t string_lookups = 0;
+static size_t string_probes = 0;
 
 
 void *gptk_malloc(size_t size)
@@ -288,6 +310,20 @@ int strcasecmp(const char *s1, const char *s2)
     return *s1 - *s2;
 }
 
+Uint32 strcasehash(const char *str)
+{   // case-insensitive FNV-1a
+    Uint32 hash = 2166136261u;
+
+    while (*str)
+    {
+        hash ^= (unsigned char)tolower(*str);
+        hash *= 16777619u;
+        str++;
+    }
+
+    return hash;
+}
+
 int strncasecmp(const char *s1, const char *s2, size_t n)
 {
     for (size_t i = 0; i < n; i++)
@@ -305,39 +341,212 @@ int strncasecmp(const char *s1, const char *s2, size_t n)
 }
 
 
+int signal_fd_open(int signum)
+{   /* Block signum and return a signalfd for it, so the signal can be
+     * handled from the event loop with event_watch_fd.
+     *
+     * Threads inherit the blocked signals, so this has to happen before
+     * SDL starts any.
+     */
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, signum);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    {
+        fprintf(stderr, "unable to block signal %d: %s\n", signum, strerror(errno));
+        return -1;
+    }
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (fd < 0)
+        fprintf(stderr, "unable to create signalfd for %d: %s\n", signum, strerror(errno));
+
+    return fd;
+}
+
+
+int signal_fd_read(int fd)
+{   // returns how many signals were waiting.
+    struct signalfd_siginfo info;
+    int count = 0;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info))
+        count++;
+
+    return count;
+}
+
+
+/* uinput output is batched per device, events are collected into a frame
+ * and written with a single write() when the SYN_REPORT arrives. This way
+ * modifiers and their key arrive as one report.
+ */
+#define EMIT_FRAME_MAX 32
+#define EMIT_FRAMES 4
+
+/* uinput can't tell us when the readers have picked up what we wrote, so
+ * before destroying the devices we wait until nothing has been written for
+ * this long. Readers poll their event devices, a couple of frames is plenty.
+ */
+#define EMIT_DRAIN_MS 40
+
+typedef struct
+{
+    int fd;
+    bool used;
+    size_t count;
+    struct input_event events[EMIT_FRAME_MAX];
+} emit_frame;
+
+static emit_frame emit_frames[EMIT_FRAMES];
+static Uint32 emit_last_write = 0;
+static bool emit_written = false;
+
+
+static void emit_frame_flush(emit_frame *frame)
+{
+    if (frame->count == 0)
+        return;
+
+    if (frame->count == 1 && frame->events[0].type == EV_SYN)
+    {   // nothing to report.
+        frame->count = 0;
+        return;
+    }
+
+    size_t frame_size = sizeof(struct input_event) * frame->count;
+    ssize_t written = output_write(frame->fd, frame->events, frame->count);
+
+    if (written < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            fprintf(stderr, "uinput %d: device busy, dropped %zu events\n", frame->fd, frame->count);
+        else
+            fprintf(stderr, "uinput %d: write failed, dropped %zu events: %s\n", frame->fd, frame->count, strerror(errno));
+    }
+    else if ((size_t)written < frame_size)
+    {
+        fprintf(stderr, "uinput %d: short write, %zu of %zu bytes\n", frame->fd, (size_t)written, frame_size);
+    }
+
+    if (written > 0)
+    {
+        emit_last_write = SDL_GetTicks();
+        emit_written = true;
+
+        GPTK2_STAT_WRITE(frame->fd, (size_t)written);
+
+        if (trace_enabled)
+            trace_write(frame->fd);
+    }
+
+    frame->count = 0;
+}
+
+
+static emit_frame *emit_frame_get(int fd)
+{
+    emit_frame *free_frame = NULL;
+
+    for (int i=0; i < EMIT_FRAMES; i++)
+    {
+        if (emit_frames[i].used && emit_frames[i].fd == fd)
+            return &emit_frames[i];
+
+        if (!emit_frames[i].used && free_frame == NULL)
+            free_frame = &emit_frames[i];
+    }
+
+    if (free_frame == NULL)
+    {   // shouldn't happen, we only have 4 devices.
+        free_frame = &emit_frames[0];
+        emit_frame_flush(free_frame);
+    }
+
+    free_frame->fd = fd;
+    free_frame->used = true;
+    free_frame->count = 0;
+
+    return free_frame;
+}
+
+
+void emit_flush_all()
+{
+    for (int i=0; i < EMIT_FRAMES; i++)
+    {
+        if (emit_frames[i].used)
+            emit_frame_flush(&emit_frames[i]);
+    }
+}
+
+
+Uint32 emit_drain(Uint32 max_wait)
+{   /* Flush everything and give the readers a chance to see it, returns how
+     * long we waited. Only waits if something was written recently.
+     */
+    emit_flush_all();
+
+    if (!emit_written)
+        return 0;
+
+    Uint32 start_ticks = SDL_GetTicks();
+    Uint32 since_write = start_ticks - emit_last_write;
+
+    if (since_write >= EMIT_DRAIN_MS)
+        return 0;
+
+    Uint32 wait = EMIT_DRAIN_MS - since_write;
+
+    if (wait > max_wait)
+        wait = max_wait;
+
+    SDL_Delay(wait);
+
+    return SDL_GetTicks() - start_ticks;
+}
+
+
 void emit(int fd, int type, int code, int val)
 {
-    struct input_event ev;
+    emit_frame *frame = emit_frame_get(fd);
+    struct input_event *ev;
+
+    if (frame->count >= EMIT_FRAME_MAX)
+        emit_frame_flush(frame);
 
-    ev.type = type;
-    ev.code = code;
-    ev.value = val;
+    ev = &frame->events[frame->count++];
+
+    ev->type = type;
+    ev->code = code;
+    ev->value = val;
     /* timestamp values below are ignored */
-    ev.time.tv_sec = 0;
-    ev.time.tv_usec = 0;
+    ev->time.tv_sec = 0;
+    ev->time.tv_usec = 0;
 
-    write(fd, &ev, sizeof(ev));
+    if (type == EV_SYN && code == SYN_REPORT)
+        emit_frame_flush(frame);
 }
 
 
 void emitModifier(bool pressed, int modifier)
-{
+{   // These go out in the same report as the key, see emitKey.
     if ((modifier & MOD_SHIFT) != 0)
     {
         emit(kb_uinp_fd, EV_KEY, KEY_LEFTSHIFT, pressed ? 1 : 0);
-        emit(kb_uinp_fd, EV_SYN, SYN_REPORT, 0);        
     }
 
     if ((modifier & MOD_ALT) != 0)
     {
         emit(kb_uinp_fd, EV_KEY, KEY_LEFTALT, pressed ? 1 : 0);
-        emit(kb_uinp_fd, EV_SYN, SYN_REPORT, 0);        
     }
 
     if ((modifier & MOD_CTRL) != 0)
     {
         emit(kb_uinp_fd, EV_KEY, KEY_LEFTCTRL, pressed ? 1 : 0);
-        emit(kb_uinp_fd, EV_SYN, SYN_REPORT, 0);        
     }
 }
 
@@ -348,45 +557,36 @@ void emitKey(int fd, int code, bool pressed, int modifier)
         return;
 
     if ((modifier != 0) && pressed)
+    {
         emitModifier(pressed, modifier);
 
+        // the modifier has to be down before the key on the other device.
+        if (fd != kb_uinp_fd)
+            emit(kb_uinp_fd, EV_SYN, SYN_REPORT, 0);
+    }
+
     if (code == BTN_GEAR_UP)
     {
         if (pressed)
-            emitMouseWheel(-current_mouse_wheel_amount);
+            emit(kb_uinp_fd, EV_REL, REL_WHEEL, -current_mouse_wheel_amount);
     }
     else if (code == BTN_GEAR_DOWN)
     {
         if (pressed)
-            emitMouseWheel(current_mouse_wheel_amount);
+            emit(kb_uinp_fd, EV_REL, REL_WHEEL, current_mouse_wheel_amount);
     }
     else
     {
         emit(fd, EV_KEY, code, pressed ? 1 : 0);
-        emit(fd, EV_SYN, SYN_REPORT, 0);
     }
 
     if ((modifier != 0) && !(pressed))
         emitModifier(pressed, modifier);
-}
-
-
-void emitTextInputKey(int code, bool uppercase)
-{
-    if (uppercase)
-    {   //capitalise capital letters by holding shift
-        emitKey(kb_uinp_fd, KEY_LEFTSHIFT, true, 0);
-    }
 
-    emitKey(kb_uinp_fd, code, true, 0);
-    SDL_Delay(16);
-    emitKey(kb_uinp_fd, code, false, 0);
-    SDL_Delay(16);
+    emit(fd, EV_SYN, SYN_REPORT, 0);
 
-    if (uppercase)
-    {   //release shift if held
-        emitKey(kb_uinp_fd, KEY_LEFTSHIFT, false, 0);
-    }
+    if ((modifier != 0) && (fd != kb_uinp_fd))
+        emit(kb_uinp_fd, EV_SYN, SYN_REPORT, 0);
 }
 
 
@@ -433,177 +633,204 @@ void emitMouseWheel(int wheel)
 }
 
 
-#define KILL_BUFFER 1024
-
-bool process_with_pkill(const char *process_name, bool use_sudo)
+static string_arena *string_arena_create(size_t size)
 {
-    char temp_buffer[KILL_BUFFER];
-
-    if (use_sudo)
-        snprintf(temp_buffer, KILL_BUFFER, "sudo pkill -9 '%s'", process_name);
-    else
-        snprintf(temp_buffer, KILL_BUFFER, "pkill -9 '%s'", process_name);
+    if (size < STRING_ARENA_SIZE)
+        size = STRING_ARENA_SIZE;
 
-    // Execute the command
-    int status = system(temp_buffer);
+    string_arena *arena = (string_arena *)gptk_malloc(sizeof(string_arena) + size);
 
-    // Check if the command executed successfully
-    if (status == -1)
-        return false;
+    arena->size = size;
+    arena->used = 0;
 
-    return true;
+    return arena;
 }
 
 
-bool process_with_kill(const char *process_name, bool use_sudo)
-{
-    char temp_buffer[KILL_BUFFER];
-    bool status = false;
-
-    snprintf(temp_buffer, KILL_BUFFER, "ps | grep '%s' | grep -v grep | awk '{print $1}'", process_name);
+static char *string_arena_alloc(size_t size)
+{   // strings are packed into arenas, they are only freed by string_quit.
+    if (string_arenas == NULL || (string_arenas->size - string_arenas->used) < size)
+    {
+        string_arena *arena = string_arena_create(size);
 
-    FILE *fp = popen(temp_buffer, "r");
-    if (fp == NULL) {
-        perror("Error executing ps command");
-        return false;
+        arena->next = string_arenas;
+        string_arenas = arena;
     }
 
-    char pid_str[32];
+    char *result = &string_arenas->data[string_arenas->used];
+    string_arenas->used += size;
 
-    if (fgets(pid_str, sizeof(pid_str), fp) != NULL)
-    {
-        // Trim the newline character
-        pid_str[strcspn(pid_str, "\n")] = 0;
+    return result;
+}
 
-        // Convert string to integer
-        int pid = atoi(pid_str);
 
-        // Kill the process
-        if (use_sudo)
-            snprintf(temp_buffer, KILL_BUFFER, "sudo kill -9 %d", pid);
-        else
-            snprintf(temp_buffer, KILL_BUFFER, "kill -9 %d", pid);
+static Uint32 strhash(const char *str, size_t len)
+{   // FNV-1a
+    Uint32 hash = 2166136261u;
 
-        int status = system(temp_buffer);
-        if (status == -1)
-        {
-            perror("Error executing kill command");
-        }
-        else
-        {
-            status = true;
-            printf("Process with name '%s' and PID %d killed successfully.\n", process_name, pid);
-        }
-    }
-    else
+    for (size_t i=0; i < len; i++)
     {
-        printf("No process with name '%s' found.\n", process_name);
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
     }
 
-    pclose(fp);
-
-    return status;
+    return hash;
 }
 
 
-void process_with_pc_quit()
+static void string_table_grow()
 {
-    emitKey(kb_uinp_fd, KEY_F4, true, KEY_LEFTALT);
-    SDL_Delay(15);
+    size_t old_size = string_table_size;
+    string_reg *old_table = string_table;
 
-    emitKey(kb_uinp_fd, KEY_F4, false, KEY_LEFTALT);
-    SDL_Delay(15);
-}
+    string_table_size = (old_size == 0) ? STRING_TABLE_MIN : old_size * 2;
+    string_table = (string_reg *)gptk_malloc(sizeof(string_reg) * string_table_size);
 
+    for (size_t i=0; i < old_size; i++)
+    {
+        if (old_table[i].string == NULL)
+            continue;
 
-bool process_kill()
-{
-    if (want_pc_quit)
-        process_with_pc_quit();
+        size_t slot = old_table[i].hash & (string_table_size - 1);
 
-    if (strlen(kill_process_name) == 0)
-        return false;
+        while (string_table[slot].string != NULL)
+            slot = (slot + 1) & (string_table_size - 1);
 
-    if (want_kill)
-        return process_with_kill(kill_process_name, want_sudo);
+        string_table[slot] = old_table[i];
+    }
 
-    return process_with_pkill(kill_process_name, want_sudo);
+    free(old_table);
 }
 
 
-string_reg *string_reg_create(const char *string)
+static const char *string_intern(const char *string, size_t string_len, bool create)
 {
-    if (string == NULL)
+    Uint32 hash = strhash(string, string_len);
+    size_t slot = hash & (string_table_size - 1);
+
+    string_lookups++;
+
+    while (string_table[slot].string != NULL)
+    {
+        string_probes++;
+
+        if (string_table[slot].hash == hash
+            && strncmp(string_table[slot].string, string, string_len) == 0
+            && string_table[slot].string[string_len] == '\0')
+        {
+            string_table[slot].counter++;
+            return string_table[slot].string;
+        }
+
+        slot = (slot + 1) & (string_table_size - 1);
+    }
+
+    if (!create)
         return NULL;
 
-    string_reg *current_string = (string_reg *)gptk_malloc(sizeof(string_reg));
-    size_t string_len = strlen(string);
+    if ((string_table_used + 1) * 2 > string_table_size)
+    {   // keep the load factor under 50%
+        string_table_grow();
+
+        slot = hash & (string_table_size - 1);
 
-    current_string->string = (char *)gptk_malloc(string_len + 1);
+        while (string_table[slot].string != NULL)
+            slot = (slot + 1) & (string_table_size - 1);
+    }
+
+    char *new_string = string_arena_alloc(string_len + 1);
+
+    memcpy(new_string, string, string_len);
+    new_string[string_len] = '\0';
 
-    memcpy(current_string->string, string, string_len + 1);
+    string_table[slot].string  = new_string;
+    string_table[slot].hash    = hash;
+    string_table[slot].counter = 1;
 
-    return current_string;
+    string_table_used++;
+    string_bytes += string_len + 1;
+
+    return new_string;
 }
 
+
 void string_init()
 {
-    root_string = string_reg_create("controls");
+    string_table_grow();
+
+    string_register("controls");
 }
 
-void string_quit()
+
+void string_dump_stats()
 {
-    string_reg *current_string = root_string;
-    string_reg *next_string;
-    int total_strings = 0;
-    int total_lookups = 0;
-    int lookup_factor = 0;
+    size_t arena_count = 0;
 
-    // printf("# String Quit\n");
-    int i=1;
-    while (current_string != NULL)
-    {
-        next_string = current_string->next;
+    for (string_arena *arena = string_arenas; arena != NULL; arena = arena->next)
+        arena_count++;
 
-        total_strings++;
-        total_lookups += current_string->counter;
-        lookup_factor += i * current_string->counter;
+    fprintf(stderr, "# Strings: %zu unique, %zu bytes in %zu arenas, table %zu slots\n",
+        string_table_used, string_bytes, arena_count, string_table_size);
 
-        // printf("# - %s\n", current_string->string);
-        free(current_string->string);
-        free(current_string);
+    fprintf(stderr, "# Strings: %zu lookups, %zu probes, %.2f probes per lookup\n",
+        string_lookups, string_probes,
+        (string_lookups > 0) ? ((double)string_probes / (double)string_lookups) : 0.0);
+}
 
-        current_string = next_string;
-        i++;
+
+void string_quit()
+{
+    string_arena *next_arena;
+
+    while (string_arenas != NULL)
+    {
+        next_arena = string_arenas->next;
+        free(string_arenas);
+        string_arenas = next_arena;
     }
 
-    // printf("# Stats: %d, %d, %d\n", total_strings, total_lookups, lookup_factor);
+    free(string_table);
+
+    string_table = NULL;
+    string_table_size = 0;
+    string_table_used = 0;
+    string_bytes = 0;
+    string_lookups = 0;
+    string_probes = 0;
 }
 
+
 const char *string_register(const char *string)
-{
+{   // intern a string, the same contents always returns the same pointer.
     if (string == NULL)
         return NULL;
 
-    string_reg *current_string = root_string;
-    string_reg *last_string = NULL;
+    return string_intern(string, strlen(string), true);
+}
 
-    while (current_string != NULL)
-    {
-        last_string = current_string;
 
-        if (strcmp(current_string->string, string) == 0)
-        {
-            current_string->counter++;
-            return current_string->string;
-        }
+const char *string_casekey(const char *string, bool create)
+{   /* Intern the lowercase version of a string, case-insensitive names can then be compared by pointer.
+     *
+     * If create is false and the key has never been registered, returns NULL.
+     */
+    if (string == NULL)
+        return NULL;
 
-        current_string = current_string->next;
-    }
+    char buffer[256];
+    char *lower = buffer;
+    size_t string_len = strlen(string);
+
+    if (string_len >= sizeof(buffer))
+        lower = (char *)gptk_malloc(string_len + 1);
+
+    for (size_t i=0; i < string_len; i++)
+        lower[i] = tolower(string[i]);
+
+    const char *result = string_intern(lower, string_len, create);
 
-    current_string = string_reg_create(string);
-    current_string->counter++;
-    last_string->next = current_string;
+    if (lower != buffer)
+        free(lower);
 
-    return current_string->string;
+    return result;
 }
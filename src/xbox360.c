@@ -54,7 +54,13 @@ void UINPUT_SET_ABS_P(
 void setupFakeXbox360Device()
 {
     struct uinput_user_dev device;
-    
+
+    if (!output_is_uinput())
+    {   // headless, see output.c
+        xbox_uinp_fd = OUTPUT_FD_XBOX;
+        return;
+    }
+
     memset(&device, 0, sizeof(device));
     strncpy(device.name, XBOX_CONTROLLER_NAME, UINPUT_MAX_NAME_SIZE);
     device.id.vendor = 0x045e;  /* sample vendor */